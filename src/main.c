@@ -107,6 +107,27 @@ static bool parse_args(mrt_context_t *ctx, const int argc, const char *argv[])
 		{
 			ctx->allow_background_image_autoscale = true;
 		}
+		else if(!strcmp(arg, "-background-video-depth") && i < argc - 1)
+		{
+			arg = argv[++i];
+
+			if(!strcmp(arg, "full"))
+				ctx->background_video_decode_depth = PLM_VIDEO_DECODE_DEPTH_FULL;
+			else if(!strcmp(arg, "skip-b"))
+				ctx->background_video_decode_depth = PLM_VIDEO_DECODE_DEPTH_SKIP_B;
+			else if(!strcmp(arg, "intra"))
+				ctx->background_video_decode_depth = PLM_VIDEO_DECODE_DEPTH_INTRA;
+			else
+			{
+				ctx->exit_code = -1;
+				show_help(name, arg);
+				return FALSE;
+			}
+		}
+		else if(!strcmp(arg, "-background-video-report") && i < argc - 1)
+		{
+			ctx->background_video_report_interval = (guint) g_ascii_strtoull(argv[++i], NULL, 10);
+		}
 		else if(!strcmp(arg, "-maximized"))
 		{
 			ctx->maximized = TRUE;
@@ -160,6 +181,8 @@ static void show_help(const char *name, const char *arg)
 		"\t-background\t\t- set background image (i.e: 'terminal.png')\n"
 		"\t-background-opacity\t- set background image opacity (i.e: 0.8)\n"
 		"\t-background-auto-scale\t- force background image to auto scale\n"
+		"\t-background-video-depth\t- set decoded video pictures (full, skip-b or intra)\n"
+		"\t-background-video-report\t- log video rate and dropped frames every N seconds\n"
 		"\t-f, --font\t\t- set font (i.e: 'IBM Plex Mono weight=650 19')\n"
 		"\t-i, --icon\t\t- set icon (i.e: 'launchpad')\n"
 		"\t-h, --help\t\t- show this help\n"
@@ -22,6 +22,8 @@
 	SOFTWARE.
 }}} */
 #include <stdio.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
 #include <marmota.h>
 
 #define PL_MPEG_IMPLEMENTATION
@@ -49,16 +51,55 @@ static void mrt_init_font(const mrt_context_t *ctx);
 static void mrt_toggle_fullscreen(mrt_context_t *ctx);
 static void mrt_toggle_scrollbar(mrt_context_t *ctx);
 
-static void mrt_background_video_on_decode(plm_t *plm, plm_frame_t *frame, void *data);
-static gboolean mrt_background_video_decode_timer_on_tick(
-	GtkWidget *widget,
-	GdkFrameClock *frame_clock,
-	gpointer data
+static void mrt_background_video_frame_to_surface(
+	mrt_context_t *ctx,
+	plm_frame_t *frame,
+	cairo_surface_t *surface,
+	const guint8 *rows
 );
+static void mrt_background_video_frame_to_queued(mrt_context_t *ctx, plm_frame_t *frame, mrt_video_frame_t *queued);
+static void mrt_background_video_update_surface(mrt_context_t *ctx, mrt_video_frame_t *queued);
+static void mrt_background_video_touch_rows(mrt_context_t *ctx, const guint8 *changed);
+static void mrt_background_video_measure(gint *cost, gint64 elapsed);
+static gpointer mrt_background_video_decode_thread(gpointer data);
+static void mrt_background_video_cache_init(mrt_context_t *ctx, plm_frame_t *frame);
+static void mrt_background_video_cache_store(
+	mrt_video_cache_t *cache,
+	plm_frame_t *frame,
+	cairo_surface_t *surface,
+	gboolean changed
+);
+static void mrt_background_video_cache_to_queued(mrt_context_t *ctx, guint index, mrt_video_frame_t *queued);
+static void mrt_background_video_cache_clear(mrt_video_cache_t *cache);
+static void mrt_background_video_cache_refill(mrt_video_cache_t *cache);
+static gint mrt_background_video_index_load(mrt_context_t *ctx, const char *filename);
+static void mrt_background_video_index_save(mrt_context_t *ctx, plm_t *plm);
+static gpointer mrt_background_video_index_thread(gpointer data);
+static void mrt_background_video_index_load_file(plm_buffer_t *buffer, void *data);
+static void mrt_background_video_present(mrt_context_t *ctx, gdouble slack);
+static void mrt_background_video_invalidate(mrt_context_t *ctx, cairo_surface_t *surface, const guint *row_versions);
+static void mrt_background_video_seek(mrt_context_t *ctx, gint seek_to);
+static void mrt_background_video_govern(mrt_context_t *ctx, gint64 frame_time, gint64 refresh_interval);
+static void mrt_background_video_report(mrt_context_t *ctx, gint rate);
+static void mrt_background_video_fold_overlay(mrt_context_t *ctx);
+static void mrt_background_video_draw(GtkWidget *widget, cairo_t *cr, mrt_context_t *ctx);
+static gboolean mrt_background_video_decode_timer_on_timeout(gpointer data);
+static gboolean mrt_background_video_decode_timer_on_restart(gpointer data);
+static void mrt_background_video_schedule(mrt_context_t *ctx);
+static void mrt_background_video_update_timer(mrt_context_t *ctx);
+static void mrt_background_video_init(mrt_context_t *ctx, plm_t *plm);
+static gboolean mrt_background_video_start(mrt_context_t *ctx, plm_frame_t *frame);
+static void mrt_background_video_play(mrt_context_t *ctx);
+static void mrt_background_video_stream_load(plm_buffer_t *buffer, void *data);
+static gboolean mrt_background_video_stream_on_read(GIOChannel *channel, GIOCondition condition, gpointer data);
+static void mrt_background_video_stream_resume(mrt_context_t *ctx);
 
 static void mrt_load_background(mrt_context_t *ctx);
 static void mrt_load_background_image(const char *filename, mrt_context_t *ctx);
 static void mrt_load_background_video(const char *filename, mrt_context_t *ctx);
+static void mrt_load_background_stream(const char *filename, mrt_context_t *ctx);
+static void mrt_background_image_paint(GtkWidget *widget, cairo_t *cr, mrt_context_t *ctx);
+static cairo_surface_t *mrt_background_image_compose(GtkWidget *widget, mrt_context_t *ctx);
 
 static gchar *mrt_find_shell(const mrt_context_t *ctx);
 static gchar *mrt_find_link(const mrt_context_t *ctx, GdkEvent *event);
@@ -68,6 +109,8 @@ static gboolean mrt_on_key_press(GtkWidget *widget, GdkEvent *event, gpointer da
 static gboolean mrt_on_button_press(GtkWidget *widget, GdkEvent *event, gpointer data);
 
 static void mrt_on_window_destroy(GtkWidget *widget, gpointer data);
+static gboolean mrt_on_window_state(GtkWidget *widget, GdkEvent *event, gpointer data);
+static gboolean mrt_on_window_visibility(GtkWidget *widget, GdkEvent *event, gpointer data);
 static void mrt_on_window_title_changed(VteTerminal *term, gpointer data);
 
 static void mrt_on_spawn(VteTerminal *term, GPid pid, GError *err, gpointer data);
@@ -381,12 +424,82 @@ gboolean mrt_init(mrt_context_t *ctx)
 
 void mrt_shutdown(mrt_context_t *ctx)
 {
-	ctx->background_video_decode_timer_id = 0;
+	int i;
+
+	if(ctx->background_video_decode_timer_id != 0)
+	{
+		g_source_remove(ctx->background_video_decode_timer_id);
+		ctx->background_video_decode_timer_id = 0;
+	}
+
+	if(ctx->background_video_stream_watch_id != 0)
+	{
+		g_source_remove(ctx->background_video_stream_watch_id);
+		ctx->background_video_stream_watch_id = 0;
+	}
+
+	if(ctx->background_video_decode_thread != NULL)
+	{
+		g_mutex_lock(&ctx->background_video_decode_mutex);
+		g_atomic_int_set(&ctx->background_video_decode_quit, TRUE);
+		g_cond_signal(&ctx->background_video_decode_cond);
+		g_mutex_unlock(&ctx->background_video_decode_mutex);
+
+		g_thread_join(ctx->background_video_decode_thread);
+		ctx->background_video_decode_thread = NULL;
+	}
+
+	if(ctx->background_video_index_thread != NULL)
+	{
+		g_thread_join(ctx->background_video_index_thread);
+		ctx->background_video_index_thread = NULL;
+	}
+
+	if(ctx->background_video_index != NULL)
+	{
+		g_bytes_unref(ctx->background_video_index);
+		ctx->background_video_index = NULL;
+	}
+
+	mrt_background_video_cache_clear(&ctx->background_video_cache);
+
+	for(i = 0; i < MRT_VIDEO_QUEUE_SIZE; i++)
+	{
+		if(ctx->background_video_queue[i].surface != NULL)
+		{
+			cairo_surface_destroy(ctx->background_video_queue[i].surface);
+			ctx->background_video_queue[i].surface = NULL;
+		}
+
+		g_free(ctx->background_video_queue[i].row_versions);
+		ctx->background_video_queue[i].row_versions = NULL;
+	}
+
+	g_free(ctx->background_video_row_versions);
+	ctx->background_video_row_versions = NULL;
+
+	g_free(ctx->background_video_surface_row_versions);
+	ctx->background_video_surface_row_versions = NULL;
+
+	g_free(ctx->background_video_changed_rows);
+	ctx->background_video_changed_rows = NULL;
+
+	g_free(ctx->background_video_dirty_rows);
+	ctx->background_video_dirty_rows = NULL;
+
+	if(ctx->background_video_scaler != NULL)
+	{
+		plm_frame_scaler_destroy(ctx->background_video_scaler);
+		ctx->background_video_scaler = NULL;
+	}
 
 	if(ctx->plm != NULL)
 	{
 		plm_destroy(ctx->plm);
 		ctx->plm = NULL;
+
+		g_cond_clear(&ctx->background_video_decode_cond);
+		g_mutex_clear(&ctx->background_video_decode_mutex);
 	}
 
 	if(ctx->background_video_buffer != NULL)
@@ -395,12 +508,43 @@ void mrt_shutdown(mrt_context_t *ctx)
 		ctx->background_video_buffer = NULL;
 	}
 
+	if(ctx->background_video_stream != NULL)
+	{
+		// Standard input is shared with whatever comes after marmota
+		if(
+			g_io_channel_unix_get_fd(ctx->background_video_stream) == fileno(stdin) &&
+			ctx->background_video_stream_stdin_flags != -1
+		)
+			fcntl(fileno(stdin), F_SETFL, ctx->background_video_stream_stdin_flags);
+
+		g_io_channel_unref(ctx->background_video_stream);
+		ctx->background_video_stream = NULL;
+	}
+
+	if(ctx->background_video_stream_data != NULL)
+	{
+		g_byte_array_unref(ctx->background_video_stream_data);
+		ctx->background_video_stream_data = NULL;
+	}
+
+	g_free(ctx->background_video_index_path);
+	ctx->background_video_index_path = NULL;
+
+	g_free(ctx->background_video_index_key);
+	ctx->background_video_index_key = NULL;
+
 	if(ctx->background_image_surface != NULL)
 	{
 		cairo_surface_destroy(ctx->background_image_surface);
 		ctx->background_image_surface = NULL;
 	}
 
+	if(ctx->background_image_composite != NULL)
+	{
+		cairo_surface_destroy(ctx->background_image_composite);
+		ctx->background_image_composite = NULL;
+	}
+
 	if(ctx->link != NULL)
 	{
 		g_free(ctx->link);
@@ -503,254 +647,1602 @@ static void mrt_toggle_scrollbar(mrt_context_t *ctx)
 		gtk_widget_hide(ctx->scrollbar);
 }
 
-static void mrt_background_video_on_decode(plm_t *plm, plm_frame_t *frame, void *data)
+static void mrt_background_video_frame_to_surface(
+	mrt_context_t *ctx,
+	plm_frame_t *frame,
+	cairo_surface_t *surface,
+	const guint8 *rows
+)
 {
-	mrt_context_t *ctx;
-	cairo_surface_t *surface;
 	guchar *pixels;
-	int stride;
-
-	MRT_UNUSED(plm);
-
-	ctx = (mrt_context_t *) data;
-	surface = ctx->background_image_surface;
+	int stride, w, h, first, last, y0, y1;
 
 	cairo_surface_flush(surface);
 
 	pixels = cairo_image_surface_get_data(surface);
+	if(pixels == NULL)
+		return;
+
 	stride = cairo_image_surface_get_stride(surface);
+	w = cairo_image_surface_get_width(surface);
+	h = cairo_image_surface_get_height(surface);
 
-	plm_frame_to_bgra(frame, pixels, stride);
+	if(w == (int) frame->width && h == (int) frame->height)
+	{
+		plm_frame_to_bgra_rows(frame, pixels, stride, rows, ctx->background_video_intensity);
+	}
+	else
+	{
+		plm_frame_to_bgra_scaled(
+			frame,
+			pixels,
+			stride,
+			w,
+			h,
+			ctx->background_video_scaler,
+			rows,
+			ctx->background_video_intensity
+		);
+	}
 
-	cairo_surface_mark_dirty(surface);
+	if(rows == NULL)
+	{
+		cairo_surface_mark_dirty(surface);
+		return;
+	}
 
-	gtk_widget_queue_draw(ctx->term);
-}
+	first = 0;
+	last = ctx->background_video_mb_rows;
 
-static gboolean mrt_background_video_decode_timer_on_tick(
-	GtkWidget *widget,
-	GdkFrameClock *frame_clock,
-	gpointer data
-)
-{
-	mrt_context_t *ctx;
-	gint seek_to;
-	gint64 frame_time;
-	double dt;
+	while(first < last && !rows[first])
+		first++;
+	while(last > first && !rows[last - 1])
+		last--;
 
-	MRT_UNUSED(widget);
+	if(first == last)
+		return;
 
-	ctx = (mrt_context_t *) data;
+	// Scaled lines are interpolated from the lines next to them as well.
+	y0 = MAX(first * 16 * h / (int) frame->height - 1, 0);
+	y1 = MIN((last * 16 * h + (int) frame->height - 1) / (int) frame->height + 1, h);
 
-	if(ctx->background_video_decode_timer_id == 0 || !gtk_window_is_active(GTK_WINDOW(ctx->win)))
-		return G_SOURCE_CONTINUE;
+	cairo_surface_mark_dirty_rectangle(surface, 0, y0, w, y1 - y0);
+}
 
-	frame_time = gdk_frame_clock_get_frame_time(frame_clock);
+// Every surface remembers which version of each macroblock row it holds, so
+// only the rows that changed since it was last filled are converted again.
+static void mrt_background_video_frame_to_queued(mrt_context_t *ctx, plm_frame_t *frame, mrt_video_frame_t *queued)
+{
+	gint i;
 
-	dt = (frame_time - ctx->background_video_decode_start_time) * 0.000001;
+	for(i = 0; i < ctx->background_video_mb_rows; i++)
+		ctx->background_video_dirty_rows[i] = queued->row_versions[i] != ctx->background_video_row_versions[i];
 
-	if(dt < MRT_VIDEO_DECODE_MAX_FPS)
-		return G_SOURCE_CONTINUE;
+	mrt_background_video_frame_to_surface(ctx, frame, queued->surface, ctx->background_video_dirty_rows);
+
+	memcpy(queued->row_versions, ctx->background_video_row_versions, ctx->background_video_mb_rows * sizeof(guint));
+}
 
-	if(dt > MRT_VIDEO_DECODE_MAX_FPS)
-		dt = MRT_VIDEO_DECODE_MAX_FPS;
+// Queued surfaces are only reallocated when the size they are drawn at changes.
+static void mrt_background_video_update_surface(mrt_context_t *ctx, mrt_video_frame_t *queued)
+{
+	cairo_surface_t *resized;
+	gint w, h;
 
-	ctx->background_video_decode_start_time = frame_time;
+	w = g_atomic_int_get(&ctx->background_video_target_width);
+	h = g_atomic_int_get(&ctx->background_video_target_height);
 
-	seek_to = ctx->background_video_decode_seek_to;
-	if(seek_to != -1)
-	{
-		plm_seek(ctx->plm, seek_to, FALSE);
-		ctx->background_video_decode_seek_to = -1;
-	}
-	else
+	if(w == cairo_image_surface_get_width(queued->surface) && h == cairo_image_surface_get_height(queued->surface))
+		return;
+
+	resized = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	if(cairo_surface_status(resized) != CAIRO_STATUS_SUCCESS)
 	{
-		plm_decode(ctx->plm, dt);
+		cairo_surface_destroy(resized);
+		return;
 	}
 
-	return G_SOURCE_CONTINUE;
+	cairo_surface_destroy(queued->surface);
+	queued->surface = resized;
+	memset(queued->row_versions, 0, ctx->background_video_mb_rows * sizeof(guint));
 }
 
-static void mrt_load_background(mrt_context_t *ctx)
+static void mrt_background_video_touch_rows(mrt_context_t *ctx, const guint8 *changed)
 {
-	const char *filename = ctx->background_image;
+	gint i;
 
-	if(filename == NULL)
-		return;
+	ctx->background_video_row_version++;
 
-	if(g_str_has_suffix(filename, ".mpg"))
-		mrt_load_background_video(filename, ctx);
-	else
-		mrt_load_background_image(filename, ctx);
+	for(i = 0; i < ctx->background_video_mb_rows; i++)
+	{
+		if(changed == NULL || changed[i])
+			ctx->background_video_row_versions[i] = ctx->background_video_row_version;
+	}
 }
 
-static void mrt_load_background_video(const char *filename, mrt_context_t *ctx)
+// Costs are kept as a running average (in microseconds), so a single slow
+// frame does not throw off the rate.
+static void mrt_background_video_measure(gint *cost, gint64 elapsed)
 {
-	cairo_status_t status;
-	plm_t *plm;
+	gint average;
+
+	average = g_atomic_int_get(cost);
+	g_atomic_int_set(cost, average + (gint) (elapsed - average) / 8);
+}
+
+// The frame queue is a single producer, single consumer ring: the decode thread
+// only advances the tail and the main thread only advances the head.
+static gpointer mrt_background_video_decode_thread(gpointer data)
+{
+	mrt_context_t *ctx;
+	mrt_video_cache_t *cache;
+	mrt_video_frame_t *queued;
 	plm_frame_t *frame;
-	int w, h;
-	gsize size = 0;
-	GError *err = NULL;
+	guint tail, index = 0;
+	gint seek_to, seek_serial, misses = 0;
+	gint64 start, decoded;
+	gdouble pts = 0.0, timestamp, last_timestamp, step, frame_duration, phase = 0.0;
+	gboolean seeked, changed, pending = FALSE, indexed;
+	GBytes *seek_index;
 
-	if(!g_file_get_contents(filename, (gchar **) &ctx->background_video_buffer, &size, &err))
-	{
-		mrt_print_gerror(err, "failed to load background video");
-		g_clear_error(&err);
-		return;
-	}
+	ctx = (mrt_context_t *) data;
+	cache = &ctx->background_video_cache;
+	indexed = ctx->background_video_indexed;
 
-	plm = plm_create_with_memory(ctx->background_video_buffer, size, FALSE);
-	if(plm == NULL)
+	tail = ctx->background_video_queue_tail;
+	seek_serial = g_atomic_int_get(&ctx->background_video_decode_seek_serial);
+	frame_duration = 1.0 / plm_get_framerate(ctx->plm);
+	last_timestamp = ctx->background_video_time;
+
+	for(;;)
 	{
-		mrt_log("failed to load backround video: '%s'", filename);
-		return;
-	}
-	ctx->plm = plm;
+		// Videos that are not cached are indexed for seeking in the background
+		// from the first time the queue is full, so neither loading nor playback
+		// wait for it. The index is taken over in between frames once built.
+		if(
+			!indexed &&
+			tail - g_atomic_int_get(&ctx->background_video_queue_head) == MRT_VIDEO_QUEUE_SIZE
+		)
+		{
+			if(cache->frames == NULL)
+			{
+				ctx->background_video_index_thread = g_thread_new(
+					"video-index",
+					mrt_background_video_index_thread,
+					ctx
+				);
+			}
+			else
+				mrt_background_video_index_save(ctx, ctx->plm);
 
-	plm_set_loop(plm, TRUE);
-	plm_set_audio_enabled(plm, FALSE);
-	plm_set_video_decode_callback(plm, mrt_background_video_on_decode, ctx);
+			indexed = TRUE;
+		}
 
-	w = plm_get_width(plm);
-	h = plm_get_height(plm);
+		seek_index = g_atomic_pointer_get(&ctx->background_video_index);
+		if(seek_index != NULL)
+		{
+			plm_set_seek_index(ctx->plm, g_bytes_get_data(seek_index, NULL), g_bytes_get_size(seek_index));
+			g_atomic_pointer_set(&ctx->background_video_index, NULL);
+			g_bytes_unref(seek_index);
+		}
 
-	if(w <= 0 || h <= 0)
-	{
-		mrt_log("background video load error: invalid dimensions (%dx%d)", w, h);
-		return;
-	}
+		g_mutex_lock(&ctx->background_video_decode_mutex);
+		while(
+			!g_atomic_int_get(&ctx->background_video_decode_quit) && (
+				tail - g_atomic_int_get(&ctx->background_video_queue_head) == MRT_VIDEO_QUEUE_SIZE || (
+					misses > 1 &&
+					seek_serial == g_atomic_int_get(&ctx->background_video_decode_seek_serial) &&
+					!ctx->background_video_stream_pending
+				)
+			)
+		)
+		{
+			g_cond_wait(&ctx->background_video_decode_cond, &ctx->background_video_decode_mutex);
+		}
+		g_mutex_unlock(&ctx->background_video_decode_mutex);
 
-	frame = plm_decode_video(plm);
-	if(frame == NULL)
-	{
-		mrt_log("background video load error: could not decode first frame");
-		return;
-	}
+		if(g_atomic_int_get(&ctx->background_video_decode_quit))
+			break;
 
-	ctx->background_image_surface = cairo_image_surface_create(
-		CAIRO_FORMAT_ARGB32,
-		w,
-		h
-	);
+		frame = NULL;
+		seeked = FALSE;
+		start = g_get_monotonic_time();
 
-	status = cairo_surface_status(ctx->background_image_surface);
-	if(status != CAIRO_STATUS_SUCCESS)
-	{
-		mrt_log("background video load error: '%s'", cairo_status_to_string(status));
-		return;
-	}
+		if(seek_serial != g_atomic_int_get(&ctx->background_video_decode_seek_serial))
+		{
+			seeked = TRUE;
+			seek_serial = g_atomic_int_get(&ctx->background_video_decode_seek_serial);
+			seek_to = g_atomic_int_get(&ctx->background_video_decode_seek_to);
 
-	mrt_background_video_on_decode(plm, frame, ctx);
+			if(cache->complete)
+			{
+				cache->position = 0;
+				while(
+					cache->position + 1 < cache->frames->len &&
+					g_array_index(cache->times, gdouble, cache->position + 1) <= seek_to
+				)
+				{
+					cache->position++;
+				}
+			}
+			else
+			{
+				// Seeking interrupts the first pass, which then starts over
+				// from the next rewind.
+				if(cache->frames != NULL)
+				{
+					mrt_background_video_cache_clear(cache);
+					cache->refill = TRUE;
+				}
+
+				frame = plm_seek_frame(ctx->plm, seek_to, FALSE);
+			}
+		}
+		else if(!cache->complete)
+		{
+			frame = plm_decode_video(ctx->plm);
 
-	ctx->background_video_decode_start_time = gdk_frame_clock_get_frame_time(
-		gtk_widget_get_frame_clock(ctx->term)
-	);
-	ctx->background_video_decode_timer_id = gtk_widget_add_tick_callback(
-		ctx->term,
-		mrt_background_video_decode_timer_on_tick,
-		ctx,
-		NULL
-	);
+			if(frame == NULL && cache->frames != NULL && cache->frames->len > 0)
+				cache->complete = TRUE;
+			else if(frame == NULL && cache->refill)
+				mrt_background_video_cache_refill(cache);
+		}
 
-	vte_terminal_set_clear_background(VTE_TERMINAL(ctx->term), FALSE);
-	g_signal_connect(G_OBJECT(ctx->term), "draw", G_CALLBACK(mrt_on_draw), ctx);
-}
+		if(cache->complete)
+		{
+			index = cache->position;
+			changed = seeked || g_ptr_array_index(cache->frames, index) != NULL;
+			timestamp = g_array_index(cache->times, gdouble, index);
 
-static void mrt_load_background_image(const char *filename, mrt_context_t *ctx)
-{
-	cairo_status_t status;
+			cache->position = (cache->position + 1) % cache->frames->len;
+		}
+		else if(frame != NULL)
+		{
+			changed = plm_get_video_changed_rows(ctx->plm, ctx->background_video_changed_rows) > 0;
+			timestamp = frame->time;
 
-	ctx->background_image_surface = cairo_image_surface_create_from_png(filename);
+			// The first cached frame is always a full one.
+			if(cache->frames != NULL && cache->frames->len == 0)
+			{
+				changed = TRUE;
+				mrt_background_video_touch_rows(ctx, NULL);
+			}
+			else if(changed)
+				mrt_background_video_touch_rows(ctx, ctx->background_video_changed_rows);
+		}
+		else
+		{
+			g_atomic_int_set(&ctx->background_video_decode_ended, plm_has_ended(ctx->plm));
+			misses++;
+			continue;
+		}
 
-	status = cairo_surface_status(ctx->background_image_surface);
-	if(status != CAIRO_STATUS_SUCCESS)
-	{
-		mrt_log("background image load error: '%s'", cairo_status_to_string(status));
-		return;
-	}
+		misses = 0;
 
-	vte_terminal_set_clear_background(VTE_TERMINAL(ctx->term), FALSE);
-	g_signal_connect(G_OBJECT(ctx->term), "draw", G_CALLBACK(mrt_on_draw), ctx);
-}
+		// Frames are due as far apart as they are in the video, which is more
+		// than a frame duration when pictures are skipped by the decode depth.
+		// The cost of decoding is spread over the frames in between as well.
+		step = timestamp - last_timestamp;
+		if(seeked || step <= 0.0)
+			step = frame_duration;
 
-static gchar *mrt_find_shell(const mrt_context_t *ctx)
-{
-	gchar *shell;
+		last_timestamp = timestamp;
+		pts += step;
 
-	if(MRT_ISSET(ctx->shell))
-		return g_strdup(ctx->shell);
+		decoded = g_get_monotonic_time();
+		mrt_background_video_measure(
+			&ctx->background_video_decode_cost,
+			(gint64) ((decoded - start) * frame_duration / step)
+		);
 
-	shell = vte_get_user_shell();
-	if(MRT_ISSET(shell))
-		return shell;
+		queued = &ctx->background_video_queue[tail % MRT_VIDEO_QUEUE_SIZE];
 
-	g_free(shell);
+		// Frames in between the ones shown at the governed rate are decoded, but
+		// neither converted nor queued. Frames cached ready to draw are always
+		// converted, since the cache is filled from the converted surface.
+		phase += g_atomic_int_get(&ctx->background_video_rate) * step;
 
-	shell = g_strdup(g_getenv("SHELL"));
-	if(MRT_ISSET(shell))
-		return shell;
+		if(!seeked && phase < 1.0 && (cache->frames == NULL || cache->complete || !cache->bgra))
+		{
+			if(frame != NULL)
+				mrt_background_video_cache_store(cache, frame, queued->surface, changed);
 
-	g_free(shell);
+			pending = pending || changed;
+			g_atomic_int_inc(&ctx->background_video_dropped_frames);
+			continue;
+		}
 
-	return g_strdup(MRT_FALLBACK_SHELL);
-}
+		phase = seeked ? 0.0 : phase - (gint) phase;
 
-static gchar *mrt_find_link(const mrt_context_t *ctx, GdkEvent *event)
-{
-	gchar *link;
+		// Frames identical to the previous one are queued without a surface,
+		// so they are neither converted nor drawn.
+		queued->changed = changed || pending;
+		queued->time = timestamp;
+		pending = FALSE;
 
-	if((link = vte_terminal_hyperlink_check_event(VTE_TERMINAL(ctx->term), event)) != NULL)
-		return link;
+		if(queued->changed)
+		{
+			if(cache->complete)
+			{
+				mrt_background_video_touch_rows(ctx, NULL);
+				mrt_background_video_update_surface(ctx, queued);
+				mrt_background_video_cache_to_queued(ctx, index, queued);
+			}
+			else
+			{
+				mrt_background_video_update_surface(ctx, queued);
+				mrt_background_video_frame_to_queued(ctx, frame, queued);
+			}
+		}
 
-	if((link = vte_terminal_match_check_event(VTE_TERMINAL(ctx->term), event, NULL)) != NULL)
-		return link;
+		if(frame != NULL)
+			mrt_background_video_cache_store(cache, frame, queued->surface, changed);
+
+		mrt_background_video_measure(&ctx->background_video_convert_cost, g_get_monotonic_time() - decoded);
+
+		queued->pts = pts;
+		queued->seek_serial = seek_serial;
+
+		g_atomic_int_set(&ctx->background_video_decode_ended, FALSE);
+		g_atomic_int_set(&ctx->background_video_queue_tail, ++tail);
+
+		// The timer stops once the video has ended and everything queued is
+		// shown, so the first frame after that, e.g. after a seek, restarts it.
+		if(g_atomic_int_compare_and_exchange(&ctx->background_video_decode_timer_stopped, TRUE, FALSE))
+			g_idle_add(mrt_background_video_decode_timer_on_restart, ctx);
+	}
 
 	return NULL;
 }
 
-static gboolean mrt_open_link(const mrt_context_t *ctx, const gchar *link)
+static void mrt_background_video_cache_init(mrt_context_t *ctx, plm_frame_t *frame)
 {
-	const gchar *argv[] = {
-		ctx->link_handler,
-		link,
-		NULL
-	};
-	GError *err = NULL;
+	mrt_video_cache_t *cache;
+	gsize count, bgra_size, yuv_size;
 
-	if(link == NULL)
-		return FALSE;
+	cache = &ctx->background_video_cache;
+	cache->budget = (gsize) ctx->background_video_cache_size * 1024 * 1024;
 
-	if(!g_spawn_async(NULL, (gchar **) argv, NULL, G_SPAWN_DEFAULT | G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, &err))
-	{
-		mrt_print_gerror(err, "could not spawn link handler for '%s'", link);
-		g_clear_error(&err);
-		return FALSE;
-	}
+	if(cache->budget == 0)
+		return;
 
-	return TRUE;
+	count = plm_get_duration(ctx->plm) * plm_get_framerate(ctx->plm) + 1;
+
+	bgra_size = cairo_image_surface_get_stride(ctx->background_image_surface) *
+		cairo_image_surface_get_height(ctx->background_image_surface);
+	yuv_size = frame->y.width * frame->y.height + frame->cr.width * frame->cr.height * 2;
+
+	// Scaled frames change size along with the window, so only unscaled ones
+	// can be cached ready to draw.
+	if(
+		!ctx->allow_background_image_scale &&
+		!ctx->allow_background_image_autoscale &&
+		count * bgra_size <= cache->budget
+	)
+		cache->frame_size = bgra_size;
+	else if(count * yuv_size <= cache->budget)
+		cache->frame_size = yuv_size;
+	else
+		return;
+
+	cache->bgra = cache->frame_size == bgra_size;
+	cache->format = *frame;
+	cache->frames = g_ptr_array_new_with_free_func(g_free);
+	cache->times = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
+	mrt_background_video_cache_store(cache, frame, ctx->background_image_surface, TRUE);
 }
 
-static gboolean mrt_on_key_press(GtkWidget *widget, GdkEvent *event, gpointer data)
+// Unchanged frames are cached as NULL and take up no space.
+static void mrt_background_video_cache_store(
+	mrt_video_cache_t *cache,
+	plm_frame_t *frame,
+	cairo_surface_t *surface,
+	gboolean changed
+)
 {
-	GdkEventKey *kevent = (GdkEventKey *) event;
-	mrt_context_t *ctx = (mrt_context_t *) data;
+	guchar *data = NULL;
+	gsize y_size, c_size;
 
-	if(ctx->allow_hold_escape_shortcut && ctx->hold && ctx->has_exit_code)
+	if(cache->frames == NULL || cache->complete)
+		return;
+
+	if(changed)
 	{
-		switch(kevent->keyval)
+		if(cache->used + cache->frame_size > cache->budget)
 		{
-			case GDK_KEY_Escape:
-				mrt_quit(ctx);
-				return TRUE;
+			mrt_background_video_cache_clear(cache);
+			return;
 		}
-	}
 
-	if(ctx->allow_fullscreen_toggle_shortcut && (kevent->state & GDK_MOD1_MASK))
-	{
-		switch(kevent->keyval)
+		data = g_malloc(cache->frame_size);
+		cache->used += cache->frame_size;
+
+		if(cache->bgra)
 		{
-			case GDK_KEY_Return:
+			cairo_surface_flush(surface);
+			memcpy(data, cairo_image_surface_get_data(surface), cache->frame_size);
+		}
+		else
+		{
+			y_size = frame->y.width * frame->y.height;
+			c_size = frame->cr.width * frame->cr.height;
+
+			memcpy(data, frame->y.data, y_size);
+			memcpy(data + y_size, frame->cr.data, c_size);
+			memcpy(data + y_size + c_size, frame->cb.data, c_size);
+		}
+	}
+
+	g_ptr_array_add(cache->frames, data);
+	g_array_append_val(cache->times, frame->time);
+}
+
+static void mrt_background_video_cache_to_queued(mrt_context_t *ctx, guint index, mrt_video_frame_t *queued)
+{
+	mrt_video_cache_t *cache;
+	plm_frame_t frame;
+	guchar *data;
+	gsize y_size, c_size;
+
+	cache = &ctx->background_video_cache;
+
+	// The first cached frame is always a full one.
+	while((data = g_ptr_array_index(cache->frames, index)) == NULL && index > 0)
+		index--;
+
+	if(cache->bgra)
+	{
+		cairo_surface_flush(queued->surface);
+		memcpy(cairo_image_surface_get_data(queued->surface), data, cache->frame_size);
+		cairo_surface_mark_dirty(queued->surface);
+
+		memcpy(queued->row_versions, ctx->background_video_row_versions, ctx->background_video_mb_rows * sizeof(guint));
+	}
+	else
+	{
+		frame = cache->format;
+
+		y_size = frame.y.width * frame.y.height;
+		c_size = frame.cr.width * frame.cr.height;
+
+		frame.y.data = data;
+		frame.cr.data = data + y_size;
+		frame.cb.data = data + y_size + c_size;
+
+		mrt_background_video_frame_to_queued(ctx, &frame, queued);
+	}
+}
+
+static void mrt_background_video_cache_clear(mrt_video_cache_t *cache)
+{
+	if(cache->frames != NULL)
+	{
+		g_ptr_array_free(cache->frames, TRUE);
+		cache->frames = NULL;
+	}
+
+	if(cache->times != NULL)
+	{
+		g_array_free(cache->times, TRUE);
+		cache->times = NULL;
+	}
+
+	cache->used = 0;
+	cache->complete = FALSE;
+}
+
+// Starts the first pass over, keeping the frame format and size of the last one.
+static void mrt_background_video_cache_refill(mrt_video_cache_t *cache)
+{
+	cache->frames = g_ptr_array_new_with_free_func(g_free);
+	cache->times = g_array_new(FALSE, FALSE, sizeof(gdouble));
+	cache->refill = FALSE;
+}
+
+// The duration and seek index of a video are kept in a file in the user cache
+// directory named after its path, so that later launches skip scanning it. The
+// file starts with a key of the size, modification time and a hash of the first
+// and last bytes of the video, and is ignored once any of them have changed.
+static gint mrt_background_video_index_load(mrt_context_t *ctx, const char *filename)
+{
+	GStatBuf st;
+	GMappedFile *mapped;
+	GChecksum *checksum;
+	const guchar *data;
+	gchar *path, *name, *contents = NULL;
+	gsize length, chunk, key_length, size = 0;
+	gint restored = -1;
+	GError *err = NULL;
+
+	path = g_canonicalize_filename(filename, NULL);
+	mapped = g_mapped_file_new(path, FALSE, &err);
+	if(mapped == NULL || g_stat(path, &st) != 0)
+	{
+		mrt_print_gerror(err, "failed to hash background video");
+		g_clear_error(&err);
+		if(mapped != NULL)
+			g_mapped_file_unref(mapped);
+		g_free(path);
+		return -1;
+	}
+
+	data = (const guchar *) g_mapped_file_get_contents(mapped);
+	length = g_mapped_file_get_length(mapped);
+	chunk = MIN(length, MRT_VIDEO_INDEX_HASH_SIZE);
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(checksum, data, chunk);
+	g_checksum_update(checksum, data + length - chunk, chunk);
+
+	ctx->background_video_index_key = g_strdup_printf(
+		"marmota video index\n%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT "\n%s\n",
+		path,
+		(gint64) length,
+		(gint64) st.st_mtime,
+		g_checksum_get_string(checksum)
+	);
+
+	g_checksum_free(checksum);
+	g_mapped_file_unref(mapped);
+
+	name = g_compute_checksum_for_string(G_CHECKSUM_SHA1, path, -1);
+	g_free(path);
+
+	path = g_strconcat(name, ".index", NULL);
+	g_free(name);
+
+	ctx->background_video_index_path = g_build_filename(g_get_user_cache_dir(), "marmota", path, NULL);
+	g_free(path);
+
+	if(g_file_get_contents(ctx->background_video_index_path, &contents, &size, NULL))
+	{
+		key_length = strlen(ctx->background_video_index_key);
+		if(size >= key_length && memcmp(contents, ctx->background_video_index_key, key_length) == 0)
+			restored = plm_set_seek_index(ctx->plm, contents + key_length, size - key_length);
+		g_free(contents);
+	}
+
+	return restored;
+}
+
+static void mrt_background_video_index_save(mrt_context_t *ctx, plm_t *plm)
+{
+	gchar *contents, *dirname;
+	gsize key_length, size;
+	GError *err = NULL;
+
+	if(ctx->background_video_index_path == NULL)
+		return;
+
+	size = plm_get_seek_index(plm, NULL, 0);
+	if(size == 0)
+		return;
+
+	key_length = strlen(ctx->background_video_index_key);
+	contents = g_malloc(key_length + size);
+	memcpy(contents, ctx->background_video_index_key, key_length);
+	plm_get_seek_index(plm, contents + key_length, size);
+
+	dirname = g_path_get_dirname(ctx->background_video_index_path);
+	if(g_mkdir_with_parents(dirname, 0700) != 0)
+	{
+		mrt_log("failed to create cache directory: '%s'", dirname);
+	}
+	else if(!g_file_set_contents(ctx->background_video_index_path, contents, key_length + size, &err))
+	{
+		mrt_print_gerror(err, "failed to save background video index");
+		g_clear_error(&err);
+	}
+
+	g_free(dirname);
+	g_free(contents);
+}
+
+// The seek index is built on a second instance reading the video with stdio,
+// so scanning it takes neither time from decoding nor every page of the mapped
+// video into memory. It is then handed over to the decode thread.
+static gpointer mrt_background_video_index_thread(gpointer data)
+{
+	mrt_context_t *ctx;
+	plm_buffer_t *buffer;
+	plm_t *plm;
+	gpointer index;
+	gsize size;
+
+	ctx = (mrt_context_t *) data;
+
+	buffer = plm_buffer_create_with_filename(ctx->background_image);
+	if(buffer == NULL)
+		return NULL;
+
+	plm_buffer_set_load_callback(buffer, mrt_background_video_index_load_file, ctx);
+	plm = plm_create_with_buffer(buffer, TRUE);
+	plm_build_seek_index(plm);
+
+	size = plm_get_seek_index(plm, NULL, 0);
+	if(size > 0 && !g_atomic_int_get(&ctx->background_video_decode_quit))
+	{
+		index = g_malloc(size);
+		plm_get_seek_index(plm, index, size);
+		mrt_background_video_index_save(ctx, plm);
+		g_atomic_pointer_set(&ctx->background_video_index, g_bytes_new_take(index, size));
+	}
+
+	plm_destroy(plm);
+	return NULL;
+}
+
+// Scanning stops at whatever has been read so far once playback is shut down
+static void mrt_background_video_index_load_file(plm_buffer_t *buffer, void *data)
+{
+	mrt_context_t *ctx = (mrt_context_t *) data;
+
+	if(g_atomic_int_get(&ctx->background_video_decode_quit))
+		plm_buffer_signal_end(buffer);
+	else
+		plm_buffer_load_file_callback(buffer, NULL);
+}
+
+// Frames are shown on the presentation closest to when they are due, so ones
+// due within the slack after the clock are shown as well.
+static void mrt_background_video_present(mrt_context_t *ctx, gdouble slack)
+{
+	mrt_video_frame_t *queued;
+	cairo_surface_t *surface, *shown_surface;
+	guint *row_versions, *shown_row_versions;
+	guint head, tail, due = 0;
+	gint seek_serial;
+
+	shown_surface = ctx->background_image_surface;
+	shown_row_versions = ctx->background_video_surface_row_versions;
+
+	head = ctx->background_video_queue_head;
+	tail = g_atomic_int_get(&ctx->background_video_queue_tail);
+	seek_serial = g_atomic_int_get(&ctx->background_video_decode_seek_serial);
+
+	for(; head != tail; head++)
+	{
+		queued = &ctx->background_video_queue[head % MRT_VIDEO_QUEUE_SIZE];
+
+		if(queued->seek_serial != seek_serial)
+			continue;
+
+		if(ctx->background_video_serial != seek_serial)
+		{
+			ctx->background_video_serial = seek_serial;
+			ctx->background_video_clock = queued->pts;
+		}
+
+		if(queued->pts > ctx->background_video_clock + slack)
+			break;
+
+		if(queued->changed)
+		{
+			due++;
+
+			surface = ctx->background_image_surface;
+			ctx->background_image_surface = queued->surface;
+			queued->surface = surface;
+
+			row_versions = ctx->background_video_surface_row_versions;
+			ctx->background_video_surface_row_versions = queued->row_versions;
+			queued->row_versions = row_versions;
+		}
+
+		ctx->background_video_time = queued->time;
+	}
+
+	// Changed frames that became due at the same time were shown too late to be seen.
+	if(due > 1)
+		ctx->background_video_late_frames += due - 1;
+
+	// The previously shown surface is handed back to the decode thread below.
+	if(shown_surface != ctx->background_image_surface)
+		mrt_background_video_invalidate(ctx, shown_surface, shown_row_versions);
+
+	if(head != ctx->background_video_queue_head)
+	{
+		g_mutex_lock(&ctx->background_video_decode_mutex);
+		g_atomic_int_set(&ctx->background_video_queue_head, head);
+		g_cond_signal(&ctx->background_video_decode_cond);
+		g_mutex_unlock(&ctx->background_video_decode_mutex);
+	}
+}
+
+// Only the rows of the widget that show changed macroblock rows are redrawn.
+static void mrt_background_video_invalidate(mrt_context_t *ctx, cairo_surface_t *surface, const guint *row_versions)
+{
+	gint i, first, width, height, h, th, y0, y1;
+
+	if(
+		cairo_image_surface_get_width(surface) != cairo_image_surface_get_width(ctx->background_image_surface) ||
+		cairo_image_surface_get_height(surface) != cairo_image_surface_get_height(ctx->background_image_surface)
+	)
+	{
+		gtk_widget_queue_draw(ctx->term);
+		return;
+	}
+
+	width = gtk_widget_get_allocated_width(ctx->term);
+	height = gtk_widget_get_allocated_height(ctx->term);
+	h = ctx->background_video_height;
+	th = ctx->background_video_target_height;
+
+	for(i = 0; i < ctx->background_video_mb_rows; i++)
+	{
+		if(row_versions[i] == ctx->background_video_surface_row_versions[i])
+			continue;
+
+		first = i;
+		while(i + 1 < ctx->background_video_mb_rows && row_versions[i + 1] != ctx->background_video_surface_row_versions[i + 1])
+			i++;
+
+		y0 = MAX((ctx->background_image_position.y + first * 16) * th / h - 1, 0);
+		y1 = MIN(((ctx->background_image_position.y + (i + 1) * 16) * th + h - 1) / h + 1, height);
+
+		if(y1 > y0)
+			gtk_widget_queue_draw_area(ctx->term, 0, y0, width, y1 - y0);
+	}
+}
+
+static void mrt_background_video_seek(mrt_context_t *ctx, gint seek_to)
+{
+	g_mutex_lock(&ctx->background_video_decode_mutex);
+	g_atomic_int_set(&ctx->background_video_decode_seek_to, seek_to);
+	g_atomic_int_inc(&ctx->background_video_decode_seek_serial);
+	g_cond_signal(&ctx->background_video_decode_cond);
+	g_mutex_unlock(&ctx->background_video_decode_mutex);
+
+	// The next wake up might be far off, but frames after a seek are due right away.
+	if(ctx->background_video_decode_timer_id != 0)
+	{
+		g_source_remove(ctx->background_video_decode_timer_id);
+		mrt_background_video_schedule(ctx);
+	}
+}
+
+// Every frame has to be decoded, but only the ones shown are converted, so the
+// rate is the highest one at which both still fit the load budget of the decode
+// thread. It never exceeds the frame rate of the video or the refresh rate.
+static void mrt_background_video_govern(mrt_context_t *ctx, gint64 frame_time, gint64 refresh_interval)
+{
+	gdouble fps, decode_cost, convert_cost;
+	gint rate, ceiling;
+
+	if(frame_time - ctx->background_video_rate_time < MRT_VIDEO_RATE_INTERVAL * G_USEC_PER_SEC)
+		return;
+
+	ctx->background_video_rate_time = frame_time;
+
+	if(ctx->background_video_report_time == 0)
+		ctx->background_video_report_time = frame_time;
+
+	if(
+		ctx->background_video_report_interval > 0 &&
+		frame_time - ctx->background_video_report_time >= (gint64) ctx->background_video_report_interval * G_USEC_PER_SEC
+	)
+	{
+		ctx->background_video_report_time = frame_time;
+		mrt_background_video_report(ctx, ctx->background_video_rate);
+	}
+
+	fps = plm_get_framerate(ctx->plm);
+	decode_cost = g_atomic_int_get(&ctx->background_video_decode_cost) / (gdouble) G_USEC_PER_SEC;
+	convert_cost = g_atomic_int_get(&ctx->background_video_convert_cost) / (gdouble) G_USEC_PER_SEC;
+
+	ceiling = MIN((gint) (fps + 0.5), (gint) ctx->background_video_max_fps);
+	if(refresh_interval > 0)
+		ceiling = MIN(ceiling, (gint) ((gdouble) G_USEC_PER_SEC / refresh_interval + 0.5));
+
+	rate = ceiling;
+	if(convert_cost > 0.0)
+		rate = MIN(rate, (gint) ((MRT_VIDEO_DECODE_LOAD - decode_cost * fps) / convert_cost));
+
+	rate = MAX(rate, (gint) ctx->background_video_min_fps);
+
+	// Small raises are ignored, so the rate does not flicker along with the costs.
+	if(rate == ctx->background_video_rate)
+		return;
+
+	if(rate > ctx->background_video_rate && rate < ceiling && rate - ctx->background_video_rate < 2)
+		return;
+
+	// Only rates held back by the load are worth reporting.
+	if(rate < ceiling || ctx->background_video_rate < ceiling)
+		mrt_background_video_report(ctx, rate);
+
+	g_atomic_int_set(&ctx->background_video_rate, rate);
+}
+
+static void mrt_background_video_report(mrt_context_t *ctx, gint rate)
+{
+	mrt_log(
+		"background video rate: %d fps (dropped: %u, late: %u)",
+		rate,
+		g_atomic_int_get(&ctx->background_video_dropped_frames),
+		ctx->background_video_late_frames
+	);
+}
+
+// Video frames are drawn additively, as the conversion leaves their alpha at 0.
+// Painting the overlay on top of them is thus the same as darkening the frames
+// by its alpha and painting it on top of the background color below them, so
+// both are done once instead of blending the whole window on every draw.
+static void mrt_background_video_fold_overlay(mrt_context_t *ctx)
+{
+	GdkRGBA *overlay, *color;
+	gdouble alpha, below;
+
+	overlay = &ctx->background_image_overlay_color;
+	color = &ctx->background_video_color;
+
+	alpha = MRT_CLAMP(overlay->alpha, 0.0, 1.0);
+	below = ctx->background_image_color.alpha * (1.0 - alpha);
+
+	*color = ctx->background_image_color;
+	color->alpha = alpha + below;
+
+	if(color->alpha > 0.0)
+	{
+		color->red = (overlay->red * alpha + ctx->background_image_color.red * below) / color->alpha;
+		color->green = (overlay->green * alpha + ctx->background_image_color.green * below) / color->alpha;
+		color->blue = (overlay->blue * alpha + ctx->background_image_color.blue * below) / color->alpha;
+	}
+
+	ctx->background_video_intensity = (gint) ((1.0 - alpha) * 256.0 + 0.5);
+}
+
+// Video frames are converted at the size they are drawn at, so the decode
+// thread is only told the target size here. Frames still in flight from before
+// a resize are scaled by cairo until the new ones arrive.
+static void mrt_background_video_draw(GtkWidget *widget, cairo_t *cr, mrt_context_t *ctx)
+{
+	cairo_surface_t *surface;
+	GdkPoint *p;
+	gint w, h, tw, th, sw, sh;
+
+	surface = ctx->background_image_surface;
+
+	w = tw = ctx->background_video_width;
+	h = th = ctx->background_video_height;
+
+	if(ctx->allow_background_image_scale)
+	{
+		p = &ctx->background_image_scale;
+		if(p->x > 0 && p->y > 0)
+		{
+			tw = w * p->x;
+			th = h * p->y;
+		}
+	}
+	else if(ctx->allow_background_image_autoscale)
+	{
+		tw = MAX(gtk_widget_get_allocated_width(widget), 1);
+		th = MAX(gtk_widget_get_allocated_height(widget), 1);
+	}
+
+	g_atomic_int_set(&ctx->background_video_target_width, tw);
+	g_atomic_int_set(&ctx->background_video_target_height, th);
+
+	p = &ctx->background_image_position;
+	cairo_translate(cr, (gdouble) p->x * tw / w, (gdouble) p->y * th / h);
+
+	sw = cairo_image_surface_get_width(surface);
+	sh = cairo_image_surface_get_height(surface);
+
+	if(sw != tw || sh != th)
+		cairo_scale(cr, (gdouble) tw / sw, (gdouble) th / sh);
+
+	cairo_set_source_surface(cr, surface, 0, 0);
+	cairo_paint(cr);
+}
+
+// The clock is advanced to the presentation the redraws queued by present()
+// will land on, as predicted by the frame clock.
+static gboolean mrt_background_video_decode_timer_on_timeout(gpointer data)
+{
+	mrt_context_t *ctx;
+	GdkFrameClock *frame_clock;
+	gint64 now, refresh_interval, presentation_time;
+	double dt;
+
+	ctx = (mrt_context_t *) data;
+	ctx->background_video_decode_timer_id = 0;
+
+	now = g_get_monotonic_time();
+	frame_clock = gtk_widget_get_frame_clock(ctx->term);
+	gdk_frame_clock_get_refresh_info(frame_clock, now, &refresh_interval, &presentation_time);
+
+	if(presentation_time == 0)
+		presentation_time = now;
+
+	mrt_background_video_govern(ctx, now, refresh_interval);
+
+	if(plm_get_mapped_file_faults() != ctx->background_video_mapped_faults)
+	{
+		ctx->background_video_mapped_faults = plm_get_mapped_file_faults();
+		mrt_log("background video was truncated while playing");
+	}
+
+	dt = (presentation_time - ctx->background_video_decode_start_time) * 0.000001;
+
+	if(dt > 0.0)
+	{
+		// Long stalls are not caught up with, the video just resumes.
+		if(dt > ctx->background_video_decode_wait + 1.0 / ctx->background_video_min_fps)
+			dt = ctx->background_video_decode_wait + 1.0 / ctx->background_video_min_fps;
+
+		ctx->background_video_decode_start_time = presentation_time;
+		ctx->background_video_clock += dt;
+	}
+
+	mrt_background_video_present(ctx, refresh_interval * 0.5 / G_USEC_PER_SEC);
+	mrt_background_video_schedule(ctx);
+	mrt_background_video_stream_resume(ctx);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean mrt_background_video_decode_timer_on_restart(gpointer data)
+{
+	mrt_context_t *ctx;
+
+	ctx = (mrt_context_t *) data;
+	mrt_background_video_update_timer(ctx);
+
+	return G_SOURCE_REMOVE;
+}
+
+// Wakes up only for the next queued frame that changes the picture, half a
+// refresh interval ahead of the presentation it is due for. Without one, it
+// wakes up once the last queued frame is due, or polls at the current rate.
+// Once the video has ended and nothing is queued anymore, it does not wake up
+// until the decode thread queues a frame again.
+static void mrt_background_video_schedule(mrt_context_t *ctx)
+{
+	mrt_video_frame_t *queued;
+	gint64 now, due, refresh_interval, presentation_time;
+	guint head, tail;
+	gint seek_serial;
+	gdouble pts;
+
+	pts = ctx->background_video_clock + 1.0 / ctx->background_video_rate;
+
+	// Stopped is set before the queue is looked at, so a frame queued right
+	// after is sure to see it.
+	g_atomic_int_set(&ctx->background_video_decode_timer_stopped, TRUE);
+
+	head = ctx->background_video_queue_head;
+	tail = g_atomic_int_get(&ctx->background_video_queue_tail);
+
+	if(head == tail && g_atomic_int_get(&ctx->background_video_decode_ended))
+	{
+		ctx->background_video_decode_timer_id = 0;
+		return;
+	}
+
+	g_atomic_int_set(&ctx->background_video_decode_timer_stopped, FALSE);
+	seek_serial = g_atomic_int_get(&ctx->background_video_decode_seek_serial);
+
+	for(; head != tail; head++)
+	{
+		queued = &ctx->background_video_queue[head % MRT_VIDEO_QUEUE_SIZE];
+
+		if(queued->seek_serial != seek_serial)
+			continue;
+
+		// The first frame after a seek restarts the clock, so it is due right away.
+		if(ctx->background_video_serial != seek_serial)
+		{
+			pts = ctx->background_video_clock;
+			break;
+		}
+
+		pts = queued->pts;
+
+		if(queued->changed)
+			break;
+	}
+
+	ctx->background_video_decode_wait = MAX(pts - ctx->background_video_clock, 0.0);
+
+	now = g_get_monotonic_time();
+	due = ctx->background_video_decode_start_time + ctx->background_video_decode_wait * G_USEC_PER_SEC;
+
+	gdk_frame_clock_get_refresh_info(
+		gtk_widget_get_frame_clock(ctx->term),
+		due - 1,
+		&refresh_interval,
+		&presentation_time
+	);
+
+	if(presentation_time != 0)
+		due = presentation_time - refresh_interval / 2;
+
+	ctx->background_video_decode_timer_id = g_timeout_add(
+		MAX(due - now, 0) / 1000,
+		mrt_background_video_decode_timer_on_timeout,
+		ctx
+	);
+}
+
+// Hidden windows have no timer at all, so nothing wakes up and the decode
+// thread blocks on the full queue until the window is visible again.
+static void mrt_background_video_update_timer(mrt_context_t *ctx)
+{
+	gboolean hidden;
+
+	if(ctx->background_video_decode_thread == NULL)
+		return;
+
+	hidden = ctx->window_obscured ||
+		(ctx->window_state & (GDK_WINDOW_STATE_WITHDRAWN | GDK_WINDOW_STATE_ICONIFIED));
+
+	if(hidden && ctx->background_video_decode_timer_id != 0)
+	{
+		g_source_remove(ctx->background_video_decode_timer_id);
+		ctx->background_video_decode_timer_id = 0;
+	}
+	else if(!hidden && ctx->background_video_decode_timer_id == 0)
+	{
+		ctx->background_video_decode_start_time = g_get_monotonic_time();
+		mrt_background_video_schedule(ctx);
+	}
+}
+
+// Sets up what files and streams have in common, before anything is decoded.
+static void mrt_background_video_init(mrt_context_t *ctx, plm_t *plm)
+{
+	ctx->plm = plm;
+	mrt_background_video_fold_overlay(ctx);
+
+	plm_set_audio_enabled(plm, FALSE);
+	plm_set_video_thread_count(
+		plm,
+		ctx->background_video_threads > 0 ? ctx->background_video_threads : g_get_num_processors()
+	);
+	plm_set_video_decode_depth(plm, ctx->background_video_decode_depth);
+
+	g_mutex_init(&ctx->background_video_decode_mutex);
+	g_cond_init(&ctx->background_video_decode_cond);
+}
+
+static gboolean mrt_background_video_start(mrt_context_t *ctx, plm_frame_t *frame)
+{
+	cairo_status_t status;
+	int i, w, h;
+
+	w = plm_get_width(ctx->plm);
+	h = plm_get_height(ctx->plm);
+
+	if(w <= 0 || h <= 0)
+	{
+		mrt_log("background video load error: invalid dimensions (%dx%d)", w, h);
+		return FALSE;
+	}
+
+	ctx->background_image_surface = cairo_image_surface_create(
+		CAIRO_FORMAT_ARGB32,
+		w,
+		h
+	);
+
+	status = cairo_surface_status(ctx->background_image_surface);
+	if(status != CAIRO_STATUS_SUCCESS)
+	{
+		mrt_log("background video load error: '%s'", cairo_status_to_string(status));
+		return FALSE;
+	}
+
+	ctx->background_video_time = frame->time;
+	ctx->background_video_width = w;
+	ctx->background_video_height = h;
+	ctx->background_video_target_width = w;
+	ctx->background_video_target_height = h;
+
+	ctx->background_video_scaler = plm_frame_scaler_create(ctx->background_video_filter);
+
+	ctx->background_video_mb_rows = (h + 15) / 16;
+	ctx->background_video_row_versions = g_new0(guint, ctx->background_video_mb_rows);
+	ctx->background_video_surface_row_versions = g_new0(guint, ctx->background_video_mb_rows);
+	ctx->background_video_changed_rows = g_new0(guint8, ctx->background_video_mb_rows);
+	ctx->background_video_dirty_rows = g_new0(guint8, ctx->background_video_mb_rows);
+
+	mrt_background_video_frame_to_surface(ctx, frame, ctx->background_image_surface, NULL);
+	mrt_background_video_touch_rows(ctx, NULL);
+	memcpy(
+		ctx->background_video_surface_row_versions,
+		ctx->background_video_row_versions,
+		ctx->background_video_mb_rows * sizeof(guint)
+	);
+
+	for(i = 0; i < MRT_VIDEO_QUEUE_SIZE; i++)
+	{
+		ctx->background_video_queue[i].row_versions = g_new0(guint, ctx->background_video_mb_rows);
+		ctx->background_video_queue[i].surface = cairo_image_surface_create(
+			CAIRO_FORMAT_ARGB32,
+			w,
+			h
+		);
+
+		status = cairo_surface_status(ctx->background_video_queue[i].surface);
+		if(status != CAIRO_STATUS_SUCCESS)
+		{
+			mrt_log("background video load error: '%s'", cairo_status_to_string(status));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void mrt_background_video_play(mrt_context_t *ctx)
+{
+	ctx->background_video_max_fps = MAX(ctx->background_video_max_fps, 1);
+	ctx->background_video_min_fps = MRT_CLAMP(ctx->background_video_min_fps, 1, ctx->background_video_max_fps);
+	ctx->background_video_rate = ctx->background_video_max_fps;
+
+	ctx->background_video_decode_thread = g_thread_new(
+		"video",
+		mrt_background_video_decode_thread,
+		ctx
+	);
+
+	ctx->window_state = gdk_window_get_state(gtk_widget_get_window(ctx->win));
+	mrt_background_video_update_timer(ctx);
+
+	gtk_widget_add_events(ctx->win, GDK_VISIBILITY_NOTIFY_MASK);
+	g_signal_connect(G_OBJECT(ctx->win), "window-state-event", G_CALLBACK(mrt_on_window_state), ctx);
+	g_signal_connect(G_OBJECT(ctx->win), "visibility-notify-event", G_CALLBACK(mrt_on_window_visibility), ctx);
+
+	vte_terminal_set_clear_background(VTE_TERMINAL(ctx->term), FALSE);
+	g_signal_connect(G_OBJECT(ctx->term), "draw", G_CALLBACK(mrt_on_draw), ctx);
+}
+
+// Called by pl_mpeg on whichever thread decodes, whenever the stream buffer
+// runs dry. Everything read so far is handed over at once.
+static void mrt_background_video_stream_load(plm_buffer_t *buffer, void *data)
+{
+	mrt_context_t *ctx;
+	GByteArray *pending;
+
+	ctx = (mrt_context_t *) data;
+	pending = ctx->background_video_stream_data;
+
+	g_mutex_lock(&ctx->background_video_decode_mutex);
+
+	if(pending->len > 0)
+	{
+		plm_buffer_write(buffer, pending->data, pending->len);
+		g_byte_array_set_size(pending, 0);
+	}
+	else if(ctx->background_video_stream_ended)
+	{
+		plm_buffer_signal_end(buffer);
+	}
+
+	ctx->background_video_stream_pending = FALSE;
+	g_mutex_unlock(&ctx->background_video_decode_mutex);
+}
+
+// Streams are read on the main loop for as long as there is room for more
+// data, which bounds the memory held by a stream that is read faster than it
+// is decoded. Until the first frame is decoded, the video is started from here.
+static gboolean mrt_background_video_stream_on_read(GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+	mrt_context_t *ctx;
+	plm_frame_t *frame;
+	guint8 chunk[MRT_VIDEO_STREAM_CHUNK_SIZE];
+	gsize length = 0;
+	gboolean full;
+	GIOStatus status;
+	GError *err = NULL;
+
+	MRT_UNUSED(condition);
+
+	ctx = (mrt_context_t *) data;
+
+	status = g_io_channel_read_chars(channel, (gchar *) chunk, sizeof(chunk), &length, &err);
+	if(status == G_IO_STATUS_AGAIN)
+		return G_SOURCE_CONTINUE;
+
+	if(status == G_IO_STATUS_ERROR)
+	{
+		mrt_print_gerror(err, "failed to read background video stream");
+		g_clear_error(&err);
+	}
+
+	g_mutex_lock(&ctx->background_video_decode_mutex);
+	g_byte_array_append(ctx->background_video_stream_data, chunk, length);
+	ctx->background_video_stream_ended = status != G_IO_STATUS_NORMAL;
+	ctx->background_video_stream_pending = TRUE;
+	full = ctx->background_video_stream_data->len >= MRT_VIDEO_STREAM_BUFFER_SIZE;
+	g_cond_signal(&ctx->background_video_decode_cond);
+	g_mutex_unlock(&ctx->background_video_decode_mutex);
+
+	if(ctx->background_video_decode_thread == NULL)
+	{
+		frame = plm_has_headers(ctx->plm) ? plm_decode_video(ctx->plm) : NULL;
+
+		if(frame != NULL)
+		{
+			if(!mrt_background_video_start(ctx, frame))
+				ctx->background_video_stream_ended = TRUE;
+			else
+				mrt_background_video_play(ctx);
+		}
+		else if(ctx->background_video_stream_ended)
+		{
+			mrt_log("background video load error: could not decode first frame");
+		}
+	}
+
+	// Full streams are resumed by the video timer, once the decode thread
+	// has caught up.
+	if(ctx->background_video_stream_ended || full)
+	{
+		ctx->background_video_stream_watch_id = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void mrt_background_video_stream_resume(mrt_context_t *ctx)
+{
+	gboolean full;
+
+	if(
+		ctx->background_video_stream == NULL ||
+		ctx->background_video_stream_watch_id != 0 ||
+		ctx->background_video_stream_ended
+	)
+		return;
+
+	g_mutex_lock(&ctx->background_video_decode_mutex);
+	full = ctx->background_video_stream_data->len >= MRT_VIDEO_STREAM_BUFFER_SIZE;
+	g_mutex_unlock(&ctx->background_video_decode_mutex);
+
+	if(full)
+		return;
+
+	ctx->background_video_stream_watch_id = g_io_add_watch(
+		ctx->background_video_stream,
+		G_IO_IN | G_IO_HUP | G_IO_ERR,
+		mrt_background_video_stream_on_read,
+		ctx
+	);
+}
+
+static void mrt_load_background(mrt_context_t *ctx)
+{
+	const char *filename = ctx->background_image;
+	GStatBuf st;
+
+	if(filename == NULL)
+		return;
+
+	// Pipes, FIFOs and devices are streamed, whatever they are called
+	if(
+		!strcmp(filename, "-") || (
+			g_stat(filename, &st) == 0 &&
+			(S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode))
+		)
+	)
+		mrt_load_background_stream(filename, ctx);
+	else if(g_str_has_suffix(filename, ".mpg"))
+		mrt_load_background_video(filename, ctx);
+	else
+		mrt_load_background_image(filename, ctx);
+}
+
+static void mrt_load_background_video(const char *filename, mrt_context_t *ctx)
+{
+	plm_t *plm;
+	plm_frame_t *frame;
+	int restored = -1;
+	gboolean predemuxed;
+	gsize size = 0;
+	GError *err = NULL;
+
+	// Truncating the file while it is mapped must not take the terminal down.
+	// This takes over SIGBUS for the whole process; nothing else in marmota
+	// installs a handler for it.
+	plm_guard_mapped_files();
+
+	plm = plm_create_with_mapped_file(filename);
+	if(plm == NULL)
+	{
+		if(!g_file_get_contents(filename, (gchar **) &ctx->background_video_buffer, &size, &err))
+		{
+			mrt_print_gerror(err, "failed to load background video");
+			g_clear_error(&err);
+			return;
+		}
+
+		plm = plm_create_with_memory(ctx->background_video_buffer, size, FALSE);
+		if(plm == NULL)
+		{
+			mrt_log("failed to load backround video: '%s'", filename);
+			return;
+		}
+	}
+
+	mrt_background_video_init(ctx, plm);
+	plm_set_loop(plm, TRUE);
+
+	// Predemuxed videos already know their duration and where to seek to
+	predemuxed = ctx->background_video_predemux && plm_predemux_video(plm);
+	if(!predemuxed)
+		restored = mrt_background_video_index_load(ctx, filename);
+
+	frame = plm_decode_video(plm);
+	if(frame == NULL)
+	{
+		mrt_log("background video load error: could not decode first frame");
+		return;
+	}
+
+	if(!mrt_background_video_start(ctx, frame))
+		return;
+
+	mrt_background_video_cache_init(ctx, frame);
+
+	// Cached videos do not need a seek index, just the duration
+	ctx->background_video_indexed = predemuxed || restored > 0 || (
+		restored == 0 &&
+		ctx->background_video_cache.frames != NULL
+	);
+
+	mrt_background_video_play(ctx);
+}
+
+// Streams are decoded from a ring buffer, which discards whatever has been
+// decoded, so they can neither loop nor seek, nor be indexed or cached.
+static void mrt_load_background_stream(const char *filename, mrt_context_t *ctx)
+{
+	plm_buffer_t *buffer;
+	plm_t *plm;
+	int fd;
+
+	if(!strcmp(filename, "-"))
+	{
+		// Restored on shutdown, as the stream is read without blocking
+		fd = fileno(stdin);
+		ctx->background_video_stream_stdin_flags = fcntl(fd, F_GETFL);
+	}
+	else
+		fd = g_open(filename, O_RDONLY | O_NONBLOCK, 0);
+
+	if(fd == -1)
+	{
+		mrt_log("failed to open background video stream: '%s'", filename);
+		return;
+	}
+
+	ctx->background_video_stream = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(ctx->background_video_stream, fd != fileno(stdin));
+	g_io_channel_set_encoding(ctx->background_video_stream, NULL, NULL);
+	g_io_channel_set_buffered(ctx->background_video_stream, FALSE);
+	g_io_channel_set_flags(ctx->background_video_stream, G_IO_FLAG_NONBLOCK, NULL);
+
+	ctx->background_video_stream_data = g_byte_array_new();
+
+	buffer = plm_buffer_create_with_capacity(MRT_VIDEO_STREAM_BUFFER_SIZE);
+	plm = plm_create_with_buffer(buffer, TRUE);
+	plm_buffer_set_load_callback(buffer, mrt_background_video_stream_load, ctx);
+
+	mrt_background_video_init(ctx, plm);
+	ctx->background_video_indexed = TRUE;
+
+	mrt_background_video_stream_resume(ctx);
+}
+
+static void mrt_load_background_image(const char *filename, mrt_context_t *ctx)
+{
+	cairo_status_t status;
+
+	ctx->background_image_surface = cairo_image_surface_create_from_png(filename);
+
+	status = cairo_surface_status(ctx->background_image_surface);
+	if(status != CAIRO_STATUS_SUCCESS)
+	{
+		mrt_log("background image load error: '%s'", cairo_status_to_string(status));
+		return;
+	}
+
+	vte_terminal_set_clear_background(VTE_TERMINAL(ctx->term), FALSE);
+	g_signal_connect(G_OBJECT(ctx->term), "draw", G_CALLBACK(mrt_on_draw), ctx);
+}
+
+static void mrt_background_image_paint(GtkWidget *widget, cairo_t *cr, mrt_context_t *ctx)
+{
+	double w, h, sx, sy;
+	GdkPoint *p;
+	cairo_surface_t *surface;
+
+	surface = ctx->background_image_surface;
+
+	cairo_save(cr);
+
+	gdk_cairo_set_source_rgba(cr, &ctx->background_image_color);
+	cairo_paint(cr);
+
+	if(ctx->allow_background_image_scale)
+	{
+		p = &ctx->background_image_scale;
+		if(p->x != 0 && p->y != 0)
+			cairo_scale(cr, p->x, p->y);
+	}
+	else if(ctx->allow_background_image_autoscale)
+	{
+		w = cairo_image_surface_get_width(surface);
+		h = cairo_image_surface_get_height(surface);
+
+		if(w > 0 && h > 0)
+		{
+			sx = gtk_widget_get_allocated_width(widget) / w;
+			sy = gtk_widget_get_allocated_height(widget) / h;
+
+			if(sx != 0 && sy != 0)
+				cairo_scale(cr, sx, sy);
+		}
+	}
+
+	p = &ctx->background_image_position;
+	cairo_set_source_surface(cr, surface, p->x, p->y);
+	cairo_paint(cr);
+
+	cairo_restore(cr);
+
+	gdk_cairo_set_source_rgba(cr, &ctx->background_image_overlay_color);
+	cairo_paint(cr);
+}
+
+// A static background only changes along with the window size, scale or
+// opacity, so it is composed once into an opaque window sized surface and
+// every redraw of the terminal is a single copy.
+static cairo_surface_t *mrt_background_image_compose(GtkWidget *widget, mrt_context_t *ctx)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	gint w, h, scale;
+
+	w = gtk_widget_get_allocated_width(widget);
+	h = gtk_widget_get_allocated_height(widget);
+	scale = gtk_widget_get_scale_factor(widget);
+
+	surface = ctx->background_image_composite;
+
+	if(
+		surface != NULL &&
+		ctx->background_image_composite_width == w &&
+		ctx->background_image_composite_height == h &&
+		ctx->background_image_composite_scale_factor == scale &&
+		ctx->background_image_composite_scale.x == ctx->background_image_scale.x &&
+		ctx->background_image_composite_scale.y == ctx->background_image_scale.y &&
+		gdk_rgba_equal(&ctx->background_image_composite_overlay_color, &ctx->background_image_overlay_color)
+	)
+	{
+		return surface;
+	}
+
+	if(surface != NULL)
+	{
+		cairo_surface_destroy(surface);
+		ctx->background_image_composite = NULL;
+	}
+
+	if(w <= 0 || h <= 0 || gtk_widget_get_window(widget) == NULL)
+		return NULL;
+
+	surface = gdk_window_create_similar_image_surface(
+		gtk_widget_get_window(widget),
+		CAIRO_FORMAT_RGB24,
+		w * scale,
+		h * scale,
+		scale
+	);
+
+	if(surface == NULL || cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+	{
+		if(surface != NULL)
+			cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	cr = cairo_create(surface);
+	mrt_background_image_paint(widget, cr, ctx);
+	cairo_destroy(cr);
+
+	ctx->background_image_composite = surface;
+	ctx->background_image_composite_width = w;
+	ctx->background_image_composite_height = h;
+	ctx->background_image_composite_scale_factor = scale;
+	ctx->background_image_composite_scale = ctx->background_image_scale;
+	ctx->background_image_composite_overlay_color = ctx->background_image_overlay_color;
+
+	return surface;
+}
+
+static gchar *mrt_find_shell(const mrt_context_t *ctx)
+{
+	gchar *shell;
+
+	if(MRT_ISSET(ctx->shell))
+		return g_strdup(ctx->shell);
+
+	shell = vte_get_user_shell();
+	if(MRT_ISSET(shell))
+		return shell;
+
+	g_free(shell);
+
+	shell = g_strdup(g_getenv("SHELL"));
+	if(MRT_ISSET(shell))
+		return shell;
+
+	g_free(shell);
+
+	return g_strdup(MRT_FALLBACK_SHELL);
+}
+
+static gchar *mrt_find_link(const mrt_context_t *ctx, GdkEvent *event)
+{
+	gchar *link;
+
+	if((link = vte_terminal_hyperlink_check_event(VTE_TERMINAL(ctx->term), event)) != NULL)
+		return link;
+
+	if((link = vte_terminal_match_check_event(VTE_TERMINAL(ctx->term), event, NULL)) != NULL)
+		return link;
+
+	return NULL;
+}
+
+static gboolean mrt_open_link(const mrt_context_t *ctx, const gchar *link)
+{
+	const gchar *argv[] = {
+		ctx->link_handler,
+		link,
+		NULL
+	};
+	GError *err = NULL;
+
+	if(link == NULL)
+		return FALSE;
+
+	if(!g_spawn_async(NULL, (gchar **) argv, NULL, G_SPAWN_DEFAULT | G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, &err))
+	{
+		mrt_print_gerror(err, "could not spawn link handler for '%s'", link);
+		g_clear_error(&err);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean mrt_on_key_press(GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+	GdkEventKey *kevent = (GdkEventKey *) event;
+	mrt_context_t *ctx = (mrt_context_t *) data;
+
+	if(ctx->allow_hold_escape_shortcut && ctx->hold && ctx->has_exit_code)
+	{
+		switch(kevent->keyval)
+		{
+			case GDK_KEY_Escape:
+				mrt_quit(ctx);
+				return TRUE;
+		}
+	}
+
+	if(ctx->allow_fullscreen_toggle_shortcut && (kevent->state & GDK_MOD1_MASK))
+	{
+		switch(kevent->keyval)
+		{
+			case GDK_KEY_Return:
 			{
 				if(ctx->fullscreen_menu_item != NULL)
 					gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(ctx->fullscreen_menu_item), !ctx->fullscreen);
@@ -778,20 +2270,24 @@ static gboolean mrt_on_key_press(GtkWidget *widget, GdkEvent *event, gpointer da
 		}
 	}
 
-	if(ctx->allow_background_video_seek_shortcut && ctx->background_video_decode_timer_id != 0)
+	if(
+		ctx->allow_background_video_seek_shortcut &&
+		ctx->background_video_decode_thread != NULL &&
+		ctx->background_video_stream == NULL
+	)
 	{
 		switch(kevent->keyval)
 		{
 			case GDK_KEY_less:
-				ctx->background_video_decode_seek_to = plm_get_time(ctx->plm) - MRT_VIDEO_SEEK_TO_AMOUNT;
+				mrt_background_video_seek(ctx, ctx->background_video_time - MRT_VIDEO_SEEK_TO_AMOUNT);
 				return TRUE;
 
 			case GDK_KEY_greater:
-				ctx->background_video_decode_seek_to = plm_get_time(ctx->plm) + MRT_VIDEO_SEEK_TO_AMOUNT;
+				mrt_background_video_seek(ctx, ctx->background_video_time + MRT_VIDEO_SEEK_TO_AMOUNT);
 				return TRUE;
 
 			case GDK_KEY_question:
-				ctx->background_video_decode_seek_to = 0;
+				mrt_background_video_seek(ctx, 0);
 				return TRUE;
 		}
 	}
@@ -862,6 +2358,33 @@ static void mrt_on_window_destroy(GtkWidget *widget, gpointer data)
 	gtk_main_quit();
 }
 
+static gboolean mrt_on_window_state(GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+	GdkEventWindowState *wevent = (GdkEventWindowState *) event;
+	mrt_context_t *ctx = (mrt_context_t *) data;
+
+	MRT_UNUSED(widget);
+
+	ctx->window_state = wevent->new_window_state;
+	mrt_background_video_update_timer(ctx);
+
+	return FALSE;
+}
+
+// Only reported without compositing, where windows can be fully covered.
+static gboolean mrt_on_window_visibility(GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+	GdkEventVisibility *vevent = (GdkEventVisibility *) event;
+	mrt_context_t *ctx = (mrt_context_t *) data;
+
+	MRT_UNUSED(widget);
+
+	ctx->window_obscured = vevent->state == GDK_VISIBILITY_FULLY_OBSCURED;
+	mrt_background_video_update_timer(ctx);
+
+	return FALSE;
+}
+
 static void mrt_on_window_title_changed(VteTerminal *term, gpointer data)
 {
 	mrt_context_t *ctx = (mrt_context_t *) data;
@@ -888,48 +2411,35 @@ static void mrt_on_spawn(VteTerminal *term, GPid pid, GError *err, gpointer data
 
 static gboolean mrt_on_draw(GtkWidget *widget, cairo_t *cr, gpointer data)
 {
-	double w, h, sx, sy;
-	GdkPoint *p;
 	cairo_surface_t *surface;
 	mrt_context_t *ctx;
 
 	ctx = (mrt_context_t *) data;
 
-	surface = ctx->background_image_surface;
-
 	cairo_save(cr);
 
-	gdk_cairo_set_source_rgba(cr, &ctx->background_image_color);
-	cairo_paint(cr);
-
-	if(ctx->allow_background_image_scale)
+	if(ctx->plm != NULL)
 	{
-		p = &ctx->background_image_scale;
-		if(p->x != 0 && p->y != 0)
-			cairo_scale(cr, p->x, p->y);
+		gdk_cairo_set_source_rgba(cr, &ctx->background_video_color);
+		cairo_paint(cr);
+
+		mrt_background_video_draw(widget, cr, ctx);
 	}
-	else if(ctx->allow_background_image_autoscale)
+	else
 	{
-		w = cairo_image_surface_get_width(surface);
-		h = cairo_image_surface_get_height(surface);
+		surface = mrt_background_image_compose(widget, ctx);
 
-		if(w > 0 && h > 0)
+		if(surface != NULL)
 		{
-			sx = gtk_widget_get_allocated_width(widget) / w;
-			sy = gtk_widget_get_allocated_height(widget) / h;
-
-			if(sx != 0 && sy != 0)
-				cairo_scale(cr, sx, sy);
+			cairo_set_source_surface(cr, surface, 0, 0);
+			cairo_paint(cr);
+		}
+		else
+		{
+			mrt_background_image_paint(widget, cr, ctx);
 		}
 	}
 
-	p = &ctx->background_image_position;
-	cairo_set_source_surface(cr, surface, p->x, p->y);
-	cairo_paint(cr);
-
-	gdk_cairo_set_source_rgba(cr, &ctx->background_image_overlay_color);
-	cairo_paint(cr);
-
 	cairo_restore(cr);
 	return FALSE;
 }
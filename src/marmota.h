@@ -66,18 +66,62 @@
 	#define MRT_FONT_SCALE_MAX 4.0
 #endif
 
-#ifndef MRT_VIDEO_DECODE_MAX_FPS
-	#define MRT_VIDEO_DECODE_MAX_FPS 1.0 / 30.0
+#ifndef MRT_VIDEO_DECODE_LOAD
+	#define MRT_VIDEO_DECODE_LOAD 0.75
+#endif
+
+#ifndef MRT_VIDEO_RATE_INTERVAL
+	#define MRT_VIDEO_RATE_INTERVAL 1
 #endif
 
 #ifndef MRT_VIDEO_SEEK_TO_AMOUNT
 	#define MRT_VIDEO_SEEK_TO_AMOUNT 3
 #endif
 
+#ifndef MRT_VIDEO_INDEX_HASH_SIZE
+	#define MRT_VIDEO_INDEX_HASH_SIZE (64 * 1024)
+#endif
+
+#ifndef MRT_VIDEO_QUEUE_SIZE
+	#define MRT_VIDEO_QUEUE_SIZE 4
+#endif
+
+#ifndef MRT_VIDEO_STREAM_BUFFER_SIZE
+	#define MRT_VIDEO_STREAM_BUFFER_SIZE (1024 * 1024)
+#endif
+
+#ifndef MRT_VIDEO_STREAM_CHUNK_SIZE
+	#define MRT_VIDEO_STREAM_CHUNK_SIZE (64 * 1024)
+#endif
+
 #ifndef MRT_CONTROL_SHIFT_MASK
 	#define MRT_CONTROL_SHIFT_MASK (GDK_CONTROL_MASK | GDK_SHIFT_MASK)
 #endif
 
+typedef struct
+{
+	cairo_surface_t *surface;
+	guint *row_versions;
+	gdouble pts;
+	gdouble time;
+	gint seek_serial;
+	gboolean changed;
+} mrt_video_frame_t;
+
+typedef struct
+{
+	GPtrArray *frames;
+	GArray *times;
+	plm_frame_t format;
+	gsize frame_size;
+	gsize budget;
+	gsize used;
+	gboolean bgra;
+	gboolean complete;
+	gboolean refill;
+	guint position;
+} mrt_video_cache_t;
+
 typedef struct
 {
 	gboolean hold;
@@ -111,6 +155,14 @@ typedef struct
 	gdouble font_scale_increment;
 	gdouble font_scale_current;
 	guint scrollback_lines;
+	guint background_video_threads;
+	guint background_video_cache_size;
+	gboolean background_video_predemux;
+	gint background_video_filter;
+	gint background_video_decode_depth;
+	guint background_video_min_fps;
+	guint background_video_max_fps;
+	guint background_video_report_interval;
 	VteCursorBlinkMode cursor_blink_mode;
 	VteCursorShape cursor_shape;
 	GdkRGBA background_image_color;
@@ -137,18 +189,73 @@ typedef struct
 	const gchar **spawn_argv;
 	gchar *link;
 	cairo_surface_t *background_image_surface;
+	cairo_surface_t *background_image_composite;
+	gint background_image_composite_width;
+	gint background_image_composite_height;
+	gint background_image_composite_scale_factor;
+	GdkPoint background_image_composite_scale;
+	GdkRGBA background_image_composite_overlay_color;
 	GtkWidget *term;
 	GtkWidget *win;
 	GtkWidget *context_menu;
 	GtkWidget *fullscreen_menu_item;
 	GtkWidget *scrollbar;
+	GdkWindowState window_state;
+	gboolean window_obscured;
 	gboolean has_exit_code;
 	gint exit_code;
 	plm_t *plm;
 	guchar *background_video_buffer;
+	GIOChannel *background_video_stream;
+	gint background_video_stream_stdin_flags;
+	guint background_video_stream_watch_id;
+	GByteArray *background_video_stream_data;
+	gboolean background_video_stream_ended;
+	gboolean background_video_stream_pending;
+	gchar *background_video_index_path;
+	gchar *background_video_index_key;
+	gboolean background_video_indexed;
+	GThread *background_video_index_thread;
+	GBytes *background_video_index;
+	gint background_video_mapped_faults;
+	GdkRGBA background_video_color;
+	gint background_video_intensity;
 	guint background_video_decode_timer_id;
+	gint background_video_decode_timer_stopped;
+	gint background_video_decode_ended;
 	gint64 background_video_decode_start_time;
+	gdouble background_video_decode_wait;
 	gint background_video_decode_seek_to;
+	gint background_video_decode_seek_serial;
+	gint background_video_decode_quit;
+	GThread *background_video_decode_thread;
+	GMutex background_video_decode_mutex;
+	GCond background_video_decode_cond;
+	mrt_video_frame_t background_video_queue[MRT_VIDEO_QUEUE_SIZE];
+	guint background_video_queue_head;
+	guint background_video_queue_tail;
+	gint background_video_serial;
+	gdouble background_video_clock;
+	gdouble background_video_time;
+	gint background_video_rate;
+	gint64 background_video_rate_time;
+	gint64 background_video_report_time;
+	gint background_video_decode_cost;
+	gint background_video_convert_cost;
+	guint background_video_dropped_frames;
+	guint background_video_late_frames;
+	gint background_video_width;
+	gint background_video_height;
+	gint background_video_target_width;
+	gint background_video_target_height;
+	plm_frame_scaler_t *background_video_scaler;
+	gint background_video_mb_rows;
+	guint background_video_row_version;
+	guint *background_video_row_versions;
+	guint *background_video_surface_row_versions;
+	guint8 *background_video_changed_rows;
+	guint8 *background_video_dirty_rows;
+	mrt_video_cache_t background_video_cache;
 } mrt_context_t;
 
 gboolean mrt_init(mrt_context_t *ctx);
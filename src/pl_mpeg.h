@@ -108,6 +108,17 @@ mat4 bt601 = mat4(
 );
 gl_FragColor = vec4(y, cb, cr, 1.0) * bt601;
 
+The plm_frame_to_*() functions, the video decoder's inverse DCT and the search
+for start codes use SSE2, SSSE3 or AVX2 (x86) and NEON (ARM) kernels where
+available. The fastest kernel
+supported by the CPU is selected at runtime and its output is bit-exact with
+the scalar code. Define PLM_NO_SIMD *before* including this library to always
+use the scalar code.
+
+The slices of a video picture can be decoded in parallel on a pool of worker
+threads with plm_set_video_thread_count() (pthreads). Define PLM_NO_THREADS
+*before* including this library to compile without thread support.
+
 Audio data is decoded into a struct with either one single float array with the
 samples for the left and right channel interleaved, or if the 
 PLM_AUDIO_SEPARATE_CHANNELS is defined *before* including this library, into
@@ -181,6 +192,7 @@ typedef struct plm_buffer_t plm_buffer_t;
 typedef struct plm_demux_t plm_demux_t;
 typedef struct plm_video_t plm_video_t;
 typedef struct plm_audio_t plm_audio_t;
+typedef struct plm_frame_scaler_t plm_frame_scaler_t;
 
 
 // Demuxed MPEG PS packet
@@ -254,6 +266,20 @@ typedef struct {
 } plm_samples_t;
 
 
+// Number of blocks the video decoder has inverse transformed with each
+// variant of the IDCT. Blocks with a single coefficient only need the DC
+// value; blocks whose coefficients are all in the first row, the first column
+// or the top-left 4x4 use reduced transforms.
+
+typedef struct {
+	uint64_t dc_only;
+	uint64_t first_row;
+	uint64_t first_column;
+	uint64_t top_left_4x4;
+	uint64_t full;
+} plm_video_idct_stats_t;
+
+
 // Callback function type for decoded audio samples used by the high-level
 // plm_* interface
 
@@ -292,6 +318,12 @@ plm_t *plm_create_with_file(FILE *fh, int close_when_done);
 plm_t *plm_create_with_memory(uint8_t *bytes, size_t length, int free_when_done);
 
 
+// Create a plmpeg instance with a memory mapped file. Returns NULL if the file
+// could not be mapped. See plm_buffer_create_with_mapped_file().
+
+plm_t *plm_create_with_mapped_file(const char *filename);
+
+
 // Create a plmpeg instance with a plm_buffer as source. Pass TRUE to
 // destroy_when_done to let plmpeg call plm_buffer_destroy() on the buffer when
 // plm_destroy() is called.
@@ -324,6 +356,27 @@ void plm_set_video_enabled(plm_t *self, int enabled);
 int plm_get_num_video_streams(plm_t *self);
 
 
+// Get or set the number of threads used to decode the slices of a video
+// picture. See plm_video_set_thread_count(). Default 1.
+
+int plm_get_video_thread_count(plm_t *self);
+void plm_set_video_thread_count(plm_t *self, int thread_count);
+
+
+// Get or set which pictures of the video stream are decoded. See 
+// plm_video_set_decode_depth(). Default PLM_VIDEO_DECODE_DEPTH_FULL.
+
+int plm_get_video_decode_depth(plm_t *self);
+void plm_set_video_decode_depth(plm_t *self, int depth);
+
+
+// Get the macroblock rows of the frame returned by the last call to
+// plm_decode_video() that differ from the frame returned before it. See
+// plm_video_get_changed_rows(). After a seek all rows are reported as changed.
+
+int plm_get_video_changed_rows(plm_t *self, uint8_t *rows);
+
+
 // Get the display width/height of the video stream.
 
 int plm_get_width(plm_t *self);
@@ -455,6 +508,42 @@ int plm_seek(plm_t *self, double time, int seek_exact);
 plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 
 
+// Build an index of all intra frames in the video stream, so that seeking does
+// a binary search instead of scanning through the data source for the last 
+// intra frame before the desired time. This reads through the whole data source
+// once and only makes sense when it is a file or fixed memory.
+// Returns the number of intra frames found.
+
+int plm_build_seek_index(plm_t *self);
+
+
+// Write the start time, duration and seek index (if one was built) of the 
+// video stream into data, e.g. to keep them in a file next to the video. See 
+// plm_demux_get_index().
+// Returns the number of bytes needed; nothing is written if size is too small.
+
+size_t plm_get_seek_index(plm_t *self, void *data, size_t size);
+
+
+// Restore what plm_get_seek_index() wrote for the same data source, so that
+// neither the duration nor the seek index have to be scanned for again.
+// Returns the number of intra frames restored or -1 if the data is invalid.
+
+int plm_set_seek_index(plm_t *self, const void *data, size_t size);
+
+
+// Demux the whole video stream at once into one contiguous elementary stream
+// in memory, along with a table of the PTS of its intra pictures. Decoding,
+// looping and seeking then read straight from memory and never go through the
+// demuxer again, which suits short, looping videos. Audio, if enabled, is 
+// still demuxed as before; plm_seek() moves the demuxer to the new time for it,
+// while plm_seek_frame() leaves it be. This rewinds the video and needs a data
+// source that can be read twice, i.e. a file or fixed memory.
+// Returns TRUE on success.
+
+int plm_predemux_video(plm_t *self);
+
+
 
 // -----------------------------------------------------------------------------
 // plm_buffer public API
@@ -468,6 +557,14 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 #endif
 
 
+// The granularity in which pages of buffers created _with_mapped_file() are
+// released once read. Must be a multiple of the page size.
+
+#ifndef PLM_BUFFER_RECLAIM_SIZE
+#define PLM_BUFFER_RECLAIM_SIZE (1024 * 1024)
+#endif
+
+
 // Create a buffer instance with a filename. Returns NULL if the file could not
 // be opened.
 
@@ -488,6 +585,45 @@ plm_buffer_t *plm_buffer_create_with_file(FILE *fh, int close_when_done);
 plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int free_when_done);
 
 
+// Create a buffer instance by mapping a file read-only into memory. The pages
+// are shared with the page cache (and other processes mapping the same file),
+// are only read in as needed and are released again in steps of
+// PLM_BUFFER_RECLAIM_SIZE once they have been read. Returns NULL if the file
+// could not be mapped or if mmap() is not available (on Windows, or when
+// PLM_NO_MMAP is defined).
+// Access pattern hints need madvise(); i.e. compile with _DEFAULT_SOURCE
+// defined when using a strict -std=c99 on glibc.
+
+plm_buffer_t *plm_buffer_create_with_mapped_file(const char *filename);
+
+
+// Keep files mapped by plm_buffer_create_with_mapped_file() from killing the
+// process with SIGBUS when they are truncated while mapped. This installs a
+// SIGBUS handler that maps zeros over what is missing of such a file, which
+// then decodes like any other broken data. Returns TRUE if the handler is
+// installed; it can not be installed without mmap() and sigaction().
+//
+// NOTE: this takes over SIGBUS for the whole process, not just for pl_mpeg.
+// - The handler replaces whatever SIGBUS handler was installed before. A
+//   fault outside of the mapped files reinstalls that previous handler and
+//   hands the fault to it; mapped files are no longer guarded from then on.
+// - A SIGBUS handler installed later replaces this one in turn, so call this
+//   before anything else installs its own, or not at all if the application
+//   relies on one.
+// - The zeros are mapped from inside the handler with mmap() and MAP_FIXED.
+//   POSIX does not count mmap() as async-signal-safe. It is a plain system
+//   call on Linux and the BSDs, but may not be safe to call from a signal
+//   handler elsewhere.
+
+int plm_guard_mapped_files(void);
+
+
+// Returns the number of times a truncated mapped file has been read since
+// plm_guard_mapped_files() was called.
+
+int plm_get_mapped_file_faults(void);
+
+
 // Create an empty buffer with an initial capacity. The buffer will grow
 // as needed. Data that has already been read, will be discarded.
 
@@ -617,6 +753,35 @@ int plm_demux_has_ended(plm_demux_t *self);
 plm_packet_t *plm_demux_seek(plm_demux_t *self, double time, int type, int force_intra);
 
 
+// Build an index of the PTS and byte offset of all packets of the specified type
+// containing the start of an intra frame, by reading through the whole data 
+// source once. Subsequent calls to plm_demux_seek() with force_intra do a binary
+// search on the index instead of scanning. The index is dropped again when the
+// size of the data source changes. This only makes sense when the underlying 
+// data source is a file or fixed memory.
+// Returns the number of intra frames found.
+
+int plm_demux_build_index(plm_demux_t *self, int type);
+
+
+// Write the start time, duration and intra frame index (if one was built) for
+// the specified packet type into data, so that they can be restored with 
+// plm_demux_set_index() later instead of scanning the data source again. The
+// data is in native byte order and only meant to be read on the same machine.
+// Returns the number of bytes needed; nothing is written if size is too small.
+
+size_t plm_demux_get_index(plm_demux_t *self, int type, void *data, size_t size);
+
+
+// Restore the start time, duration and intra frame index from data written by
+// plm_demux_get_index() for the same packet type and data source.
+// Returns the number of intra frames restored or -1 if the data is invalid or
+// the size of the data source has changed since. Data whose entries lie beyond
+// the end of the data source or are out of order is invalid as well.
+
+int plm_demux_set_index(plm_demux_t *self, int type, const void *data, size_t size);
+
+
 // Get the PTS of the first packet of this type. Returns PLM_PACKET_INVALID_TS
 // if not packet of this packet type can be found.
 
@@ -676,6 +841,31 @@ int plm_video_get_height(plm_video_t *self);
 void plm_video_set_no_delay(plm_video_t *self, int no_delay);
 
 
+// Get or set the number of threads used to decode the slices of a picture.
+// Slices are independent, so a picture is split across (thread_count - 1)
+// worker threads and the calling thread. Decoding is serial with a thread
+// count of 1 (the default) and when compiled without thread support
+// (PLM_NO_THREADS, or on Windows). The decoded frames are identical either way.
+
+int plm_video_get_thread_count(plm_video_t *self);
+void plm_video_set_thread_count(plm_video_t *self, int thread_count);
+
+
+// Get or set which pictures are decoded: all of them (the default), all but
+// B-pictures, or only intra pictures. Skipped pictures are found by their start
+// code alone, without any VLC decoding or IDCT, but still count towards the 
+// time; plm_video_decode() just returns fewer frames further apart, each with
+// its correct time. After going back to a fuller depth, pictures that predict
+// from skipped ones are skipped as well until the next intra picture.
+
+#define PLM_VIDEO_DECODE_DEPTH_FULL 0
+#define PLM_VIDEO_DECODE_DEPTH_SKIP_B 1
+#define PLM_VIDEO_DECODE_DEPTH_INTRA 2
+
+int plm_video_get_decode_depth(plm_video_t *self);
+void plm_video_set_decode_depth(plm_video_t *self, int depth);
+
+
 // Get the current internal time in seconds.
 
 double plm_video_get_time(plm_video_t *self);
@@ -705,6 +895,25 @@ int plm_video_has_ended(plm_video_t *self);
 plm_frame_t *plm_video_decode(plm_video_t *self);
 
 
+// Get the macroblock rows (16 lines each) of the frame returned by the last
+// call to plm_video_decode() that differ from the frame returned before it.
+// This is tracked while decoding: rows made up entirely of macroblocks that
+// were skipped, or copied from a reference picture without motion or residual,
+// are unchanged. No pixels are compared, so identical rows coded any other way
+// still count as changed. Returns the number of changed rows, i.e. 0 if the
+// frame is identical to the previous one. If rows is not NULL, it receives
+// TRUE or FALSE for each row and must hold at least (height + 15) / 16 entries.
+// The first frame after creation or a rewind always has all rows changed.
+
+int plm_video_get_changed_rows(plm_video_t *self, uint8_t *rows);
+
+
+// Get the number of blocks decoded with each IDCT variant since the video
+// decoder was created.
+
+plm_video_idct_stats_t plm_video_get_idct_stats(plm_video_t *self);
+
+
 // Convert the YCrCb data of a frame into interleaved R G B data. The stride
 // specifies the width in bytes of the destination buffer. I.e. the number of
 // bytes from one line to the next. The stride must be at least 
@@ -720,6 +929,54 @@ void plm_frame_to_argb(plm_frame_t *frame, uint8_t *dest, int stride);
 void plm_frame_to_abgr(plm_frame_t *frame, uint8_t *dest, int stride);
 
 
+// Convert only the macroblock rows (16 lines each) of a frame for which rows
+// is TRUE, e.g. as filled in by plm_video_get_changed_rows(), or all of them if
+// rows is NULL. The dest buffer is the same as for the full frame; all other 
+// lines are left untouched. The converted R, G and B values are multiplied by
+// intensity / 256, e.g. to fade the frame towards black for a translucent 
+// overlay drawn on top of it; an intensity of 256 leaves them as is.
+
+void plm_frame_to_rgb_rows(plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity);
+void plm_frame_to_bgr_rows(plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity);
+void plm_frame_to_rgba_rows(plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity);
+void plm_frame_to_bgra_rows(plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity);
+void plm_frame_to_argb_rows(plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity);
+void plm_frame_to_abgr_rows(plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity);
+
+
+// Create a scaler for converting frames to another size with either
+// PLM_FRAME_FILTER_NEAREST or PLM_FRAME_FILTER_BILINEAR, which interpolates the
+// Y, Cr and Cb planes before conversion. The scaler keeps the sample positions
+// and line buffers for the last frame size and destination size, so it should
+// be kept for as long as these stay the same. A scaler must not be used by more 
+// than one thread at a time.
+
+#define PLM_FRAME_FILTER_NEAREST 0
+#define PLM_FRAME_FILTER_BILINEAR 1
+
+plm_frame_scaler_t *plm_frame_scaler_create(int filter);
+
+
+// Destroy a scaler and free all data.
+
+void plm_frame_scaler_destroy(plm_frame_scaler_t *self);
+
+
+// Convert and scale the YCrCb data of a frame to width x height pixels, without
+// an intermediate full size buffer. The buffer pointed to by *dest must have a
+// size of at least (stride * height). With the frame's own size the output is
+// identical to the plm_frame_to_*() functions. If rows is not NULL, lines that
+// only sample from macroblock rows for which rows is FALSE may be left 
+// untouched. The intensity is applied the same way as with plm_frame_to_*_rows().
+
+void plm_frame_to_rgb_scaled(plm_frame_t *frame, uint8_t *dest, int stride, int width, int height, plm_frame_scaler_t *scaler, const uint8_t *rows, int intensity);
+void plm_frame_to_bgr_scaled(plm_frame_t *frame, uint8_t *dest, int stride, int width, int height, plm_frame_scaler_t *scaler, const uint8_t *rows, int intensity);
+void plm_frame_to_rgba_scaled(plm_frame_t *frame, uint8_t *dest, int stride, int width, int height, plm_frame_scaler_t *scaler, const uint8_t *rows, int intensity);
+void plm_frame_to_bgra_scaled(plm_frame_t *frame, uint8_t *dest, int stride, int width, int height, plm_frame_scaler_t *scaler, const uint8_t *rows, int intensity);
+void plm_frame_to_argb_scaled(plm_frame_t *frame, uint8_t *dest, int stride, int width, int height, plm_frame_scaler_t *scaler, const uint8_t *rows, int intensity);
+void plm_frame_to_abgr_scaled(plm_frame_t *frame, uint8_t *dest, int stride, int width, int height, plm_frame_scaler_t *scaler, const uint8_t *rows, int intensity);
+
+
 // -----------------------------------------------------------------------------
 // plm_audio public API
 // Decode MPEG-1 Audio Layer II ("mp2") data into raw samples
@@ -804,9 +1061,109 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self);
 #define PLM_UNUSED(expr) (void)(expr)
 
 
+// -----------------------------------------------------------------------------
+// SIMD support and runtime CPU feature detection
+
+#if !defined(PLM_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define PLM_SIMD_X86
+	#define PLM_SIMD_TARGET(T) __attribute__((target(T)))
+	#include <immintrin.h>
+#elif !defined(PLM_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	#define PLM_SIMD_NEON
+	#include <arm_neon.h>
+#endif
+
+
+// -----------------------------------------------------------------------------
+// Thread support for slice-parallel video decoding
+
+#if !defined(PLM_NO_THREADS) && !defined(_WIN32)
+	#define PLM_THREADS
+	#include <pthread.h>
+#endif
+
+
+// -----------------------------------------------------------------------------
+// Memory mapped file support for plm_buffer_create_with_mapped_file()
+
+#if !defined(PLM_NO_MMAP) && !defined(_WIN32)
+	#define PLM_MMAP
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#include <signal.h>
+
+	#if defined(__GNUC__) && defined(MAP_ANONYMOUS) && defined(SA_SIGINFO)
+		#define PLM_MMAP_GUARD
+	#endif
+#endif
+
+// The number of mapped files that plm_guard_mapped_files() can keep track of
+// at the same time. Files mapped beyond that are not guarded.
+
+#ifndef PLM_MMAP_GUARD_SLOTS
+#define PLM_MMAP_GUARD_SLOTS 16
+#endif
+
+enum plm_cpu_feature {
+	PLM_CPU_SSE2 = 1 << 0,
+	PLM_CPU_SSSE3 = 1 << 1,
+	PLM_CPU_AVX2 = 1 << 2,
+	PLM_CPU_NEON = 1 << 3
+};
+
+int plm_cpu_features(void);
+void plm_cpu_features_detect(void);
+
+// Detected once, before the first caller reads it; under PLM_THREADS through
+// pthread_once(), as decoders on several threads may ask at the same time.
+
+static int plm_cpu_features_detected = 0;
+
+void plm_cpu_features_detect(void) {
+	int detected = 0;
+	#if defined(PLM_SIMD_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2")) {
+			detected |= PLM_CPU_SSE2;
+		}
+		if (__builtin_cpu_supports("ssse3")) {
+			detected |= PLM_CPU_SSSE3;
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			detected |= PLM_CPU_AVX2;
+		}
+	#elif defined(PLM_SIMD_NEON)
+		detected |= PLM_CPU_NEON;
+	#endif
+
+	plm_cpu_features_detected = detected;
+}
+
+int plm_cpu_features(void) {
+	#ifdef PLM_THREADS
+		static pthread_once_t once = PTHREAD_ONCE_INIT;
+		pthread_once(&once, plm_cpu_features_detect);
+	#else
+		static int done = FALSE;
+		if (!done) {
+			plm_cpu_features_detect();
+			done = TRUE;
+		}
+	#endif
+	return plm_cpu_features_detected;
+}
+
+
 // -----------------------------------------------------------------------------
 // plm (high-level interface) implementation
 
+typedef struct {
+	double pts;
+	size_t offset;
+} plm_pts_entry_t;
+
 struct plm_t {
 	plm_demux_t *demux;
 	double time;
@@ -816,8 +1173,14 @@ struct plm_t {
 
 	int video_enabled;
 	int video_packet_type;
+	int video_thread_count;
+	int video_decode_depth;
+	int video_changed_rows_valid;
 	plm_buffer_t *video_buffer;
 	plm_video_t *video_decoder;
+	int video_predemuxed;
+	plm_pts_entry_t *video_pts;
+	int video_pts_length;
 
 	int audio_enabled;
 	int audio_stream_index;
@@ -834,10 +1197,13 @@ struct plm_t {
 };
 
 int plm_init_decoders(plm_t *self);
+int plm_sources_have_ended(plm_t *self);
 void plm_handle_end(plm_t *self);
 void plm_read_video_packet(plm_buffer_t *buffer, void *user);
 void plm_read_audio_packet(plm_buffer_t *buffer, void *user);
 void plm_read_packets(plm_t *self, int requested_type);
+void plm_buffer_seek(plm_buffer_t *self, size_t pos);
+plm_buffer_t *plm_demux_extract(plm_demux_t *self, int type, plm_pts_entry_t **pts, int *pts_length);
 
 plm_t *plm_create_with_filename(const char *filename) {
 	plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
@@ -857,12 +1223,21 @@ plm_t *plm_create_with_memory(uint8_t *bytes, size_t length, int free_when_done)
 	return plm_create_with_buffer(buffer, TRUE);
 }
 
+plm_t *plm_create_with_mapped_file(const char *filename) {
+	plm_buffer_t *buffer = plm_buffer_create_with_mapped_file(filename);
+	if (!buffer) {
+		return NULL;
+	}
+	return plm_create_with_buffer(buffer, TRUE);
+}
+
 plm_t *plm_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
 	plm_t *self = (plm_t *)malloc(sizeof(plm_t));
 	memset(self, 0, sizeof(plm_t));
 
 	self->demux = plm_demux_create(buffer, destroy_when_done);
 	self->video_enabled = TRUE;
+	self->video_thread_count = 1;
 	self->audio_enabled = TRUE;
 	plm_init_decoders(self);
 
@@ -896,6 +1271,8 @@ int plm_init_decoders(plm_t *self) {
 
 	if (self->video_buffer) {
 		self->video_decoder = plm_video_create_with_buffer(self->video_buffer, TRUE);
+		plm_video_set_thread_count(self->video_decoder, self->video_thread_count);
+		plm_video_set_decode_depth(self->video_decoder, self->video_decode_depth);
 	}
 
 	if (self->audio_buffer) {
@@ -915,6 +1292,9 @@ void plm_destroy(plm_t *self) {
 	}
 
 	plm_demux_destroy(self->demux);
+	if (self->video_pts) {
+		free(self->video_pts);
+	}
 	free(self);
 }
 
@@ -981,6 +1361,48 @@ void plm_set_video_enabled(plm_t *self, int enabled) {
 		: 0;
 }
 
+int plm_get_video_thread_count(plm_t *self) {
+	return self->video_thread_count;
+}
+
+void plm_set_video_thread_count(plm_t *self, int thread_count) {
+	self->video_thread_count = thread_count < 1 ? 1 : thread_count;
+
+	if (self->video_decoder) {
+		plm_video_set_thread_count(self->video_decoder, self->video_thread_count);
+	}
+}
+
+int plm_get_video_decode_depth(plm_t *self) {
+	return self->video_decode_depth;
+}
+
+void plm_set_video_decode_depth(plm_t *self, int depth) {
+	self->video_decode_depth = depth;
+
+	if (self->video_decoder) {
+		plm_video_set_decode_depth(self->video_decoder, self->video_decode_depth);
+	}
+}
+
+int plm_get_video_changed_rows(plm_t *self, uint8_t *rows) {
+	if (!plm_init_decoders(self) || !self->video_decoder) {
+		return 0;
+	}
+
+	// A seek may decode several frames internally; the changes are relative
+	// to the last one of those, which was never returned.
+	if (!self->video_changed_rows_valid) {
+		int mb_height = (plm_video_get_height(self->video_decoder) + 15) >> 4;
+		if (rows) {
+			memset(rows, TRUE, mb_height);
+		}
+		return mb_height;
+	}
+
+	return plm_video_get_changed_rows(self->video_decoder, rows);
+}
+
 int plm_get_num_video_streams(plm_t *self) {
 	return plm_demux_get_num_video_streams(self->demux);
 }
@@ -1090,6 +1512,7 @@ void plm_decode(plm_t *self, double tick) {
 		if (decode_video && plm_video_get_time(self->video_decoder) < video_target_time) {
 			plm_frame_t *frame = plm_video_decode(self->video_decoder);
 			if (frame) {
+				self->video_changed_rows_valid = TRUE;
 				self->video_decode_callback(self, frame, self->video_decode_callback_user_data);
 				did_decode = TRUE;
 			}
@@ -1114,7 +1537,7 @@ void plm_decode(plm_t *self, double tick) {
 	if (
 		(!decode_video || decode_video_failed) && 
 		(!decode_audio || decode_audio_failed) &&
-		plm_demux_has_ended(self->demux)
+		plm_sources_have_ended(self)
 	) {
 		plm_handle_end(self);
 		return;
@@ -1135,8 +1558,9 @@ plm_frame_t *plm_decode_video(plm_t *self) {
 	plm_frame_t *frame = plm_video_decode(self->video_decoder);
 	if (frame) {
 		self->time = frame->time;
+		self->video_changed_rows_valid = TRUE;
 	}
-	else if (plm_demux_has_ended(self->demux)) {
+	else if (plm_sources_have_ended(self)) {
 		plm_handle_end(self);
 	}
 	return frame;
@@ -1161,6 +1585,17 @@ plm_samples_t *plm_decode_audio(plm_t *self) {
 	return samples;
 }
 
+int plm_sources_have_ended(plm_t *self) {
+	// Predemuxed video ends with its own buffer, not with the demuxer, which
+	// only still moves when there is audio.
+	if (self->video_predemuxed) {
+		return plm_buffer_has_ended(self->video_buffer) && (
+			!self->audio_packet_type || plm_demux_has_ended(self->demux)
+		);
+	}
+	return plm_demux_has_ended(self->demux);
+}
+
 void plm_handle_end(plm_t *self) {
 	if (self->loop) {
 		plm_rewind(self);
@@ -1183,6 +1618,9 @@ void plm_read_audio_packet(plm_buffer_t *buffer, void *user) {
 }
 
 void plm_read_packets(plm_t *self, int requested_type) {
+	// Payloads are copied into the elementary stream buffers once. Even when
+	// the source is in memory or mapped, consecutive payloads are separated by
+	// pack and packet headers, while the bit reader needs them back to back.
 	plm_packet_t *packet;
 	while ((packet = plm_demux_decode(self->demux))) {
 		if (packet->type == self->video_packet_type) {
@@ -1227,20 +1665,46 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
 	else if (time > duration) {
 		time = duration;
 	}
-	
-	plm_packet_t *packet = plm_demux_seek(self->demux, time, type, TRUE);
-	if (!packet) {
-		return NULL;
+
+	plm_packet_t *packet = NULL;
+	if (!self->video_predemuxed) {
+		packet = plm_demux_seek(self->demux, time, type, TRUE);
+		if (!packet) {
+			return NULL;
+		}
 	}
 
 	// Disable writing to the audio buffer while decoding video
 	int previous_audio_packet_type = self->audio_packet_type;
 	self->audio_packet_type = 0;
 
-	// Clear video buffer and decode the found packet
+	// Clear video buffer and decode the found packet, or for predemuxed video
+	// jump to the last intra picture at or before the time. If there is none,
+	// the beginning is the best we can do.
 	plm_video_rewind(self->video_decoder);
-	plm_video_set_time(self->video_decoder, packet->pts - start_time);
-	plm_buffer_write(self->video_buffer, packet->data, packet->length);
+	if (packet) {
+		plm_video_set_time(self->video_decoder, packet->pts - start_time);
+		plm_buffer_write(self->video_buffer, packet->data, packet->length);
+	}
+	else {
+		int low = 0;
+		int high = self->video_pts_length;
+		while (low < high) {
+			int mid = (low + high) >> 1;
+			if (self->video_pts[mid].pts <= time + start_time) {
+				low = mid + 1;
+			}
+			else {
+				high = mid;
+			}
+		}
+
+		if (low > 0) {
+			plm_pts_entry_t *entry = &self->video_pts[low - 1];
+			plm_video_set_time(self->video_decoder, entry->pts - start_time);
+			plm_buffer_seek(self->video_buffer, entry->offset);
+		}
+	}
 	plm_frame_t *frame = plm_video_decode(self->video_decoder);	
 
 	// If we want to seek to an exact frame, we have to decode all frames
@@ -1258,10 +1722,83 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
 		self->time = frame->time;
 	}
 
+	self->video_changed_rows_valid = FALSE;
 	self->has_ended = FALSE;
 	return frame;
 }
 
+int plm_build_seek_index(plm_t *self) {
+	if (!plm_init_decoders(self)) {
+		return 0;
+	}
+
+	if (!self->video_packet_type) {
+		return 0;
+	}
+
+	return plm_demux_build_index(self->demux, self->video_packet_type);
+}
+
+size_t plm_get_seek_index(plm_t *self, void *data, size_t size) {
+	if (!plm_init_decoders(self)) {
+		return 0;
+	}
+
+	if (!self->video_packet_type) {
+		return 0;
+	}
+
+	return plm_demux_get_index(self->demux, self->video_packet_type, data, size);
+}
+
+int plm_set_seek_index(plm_t *self, const void *data, size_t size) {
+	if (!plm_init_decoders(self)) {
+		return -1;
+	}
+
+	if (!self->video_packet_type) {
+		return -1;
+	}
+
+	return plm_demux_set_index(self->demux, self->video_packet_type, data, size);
+}
+
+int plm_predemux_video(plm_t *self) {
+	if (!plm_init_decoders(self)) {
+		return FALSE;
+	}
+
+	if (!self->video_packet_type) {
+		return FALSE;
+	}
+
+	if (self->video_predemuxed) {
+		return TRUE;
+	}
+
+	plm_pts_entry_t *pts = NULL;
+	int pts_length = 0;
+	plm_buffer_t *buffer = plm_demux_extract(self->demux, self->video_packet_type, &pts, &pts_length);
+	if (!buffer) {
+		return FALSE;
+	}
+
+	plm_video_destroy(self->video_decoder);
+
+	self->video_buffer = buffer;
+	self->video_decoder = plm_video_create_with_buffer(self->video_buffer, TRUE);
+	plm_video_set_thread_count(self->video_decoder, self->video_thread_count);
+	plm_video_set_decode_depth(self->video_decoder, self->video_decode_depth);
+
+	self->video_predemuxed = TRUE;
+	self->video_pts = pts;
+	self->video_pts_length = pts_length;
+	self->video_changed_rows_valid = FALSE;
+	self->has_ended = FALSE;
+	self->time = 0;
+	return TRUE;
+}
+
 int plm_seek(plm_t *self, double time, int seek_exact) {
 	plm_frame_t *frame = plm_seek_frame(self, time, seek_exact);
 	
@@ -1285,6 +1822,12 @@ int plm_seek(plm_t *self, double time, int seek_exact) {
 	double start_time = plm_demux_get_start_time(self->demux, self->video_packet_type);
 	plm_audio_rewind(self->audio_decoder);
 
+	// Predemuxed video is seeked in memory and leaves the demuxer where it
+	// was, so move it to the audio just before the new time first.
+	if (self->video_predemuxed) {
+		plm_demux_seek(self->demux, self->time, self->audio_packet_type, FALSE);
+	}
+
 	plm_packet_t *packet = NULL;
 	while ((packet = plm_demux_decode(self->demux))) {
 		if (packet->type == self->video_packet_type) {
@@ -1309,6 +1852,12 @@ int plm_seek(plm_t *self, double time, int seek_exact) {
 // -----------------------------------------------------------------------------
 // plm_buffer implementation
 
+// Buffers that own their memory allocate this many extra bytes behind their
+// capacity, so that plm_buffer_read() can always load a full 64 bit word
+// starting at the current byte.
+
+#define PLM_BUFFER_TAIL_PADDING 8
+
 enum plm_buffer_mode {
 	PLM_BUFFER_MODE_FILE,
 	PLM_BUFFER_MODE_FIXED_MEM,
@@ -1321,6 +1870,7 @@ struct plm_buffer_t {
 	size_t capacity;
 	size_t length;
 	size_t total_size;
+	size_t tail_padding;
 	int discard_read_bytes;
 	int has_ended;
 	int free_when_done;
@@ -1330,6 +1880,16 @@ struct plm_buffer_t {
 	void *load_callback_user_data;
 	uint8_t *bytes;
 	enum plm_buffer_mode mode;
+	size_t mapped_length;
+	size_t reclaimed_index;
+
+	// The last search for a start code: where it began, the code and whether
+	// it was found, and where it was found or where the search ran out of
+	// data. Kept in sync when the unread data is shifted down.
+	size_t scan_from;
+	size_t scan_index;
+	int scan_code;
+	int scan_found;
 };
 
 typedef struct {
@@ -1342,22 +1902,52 @@ typedef struct {
 	uint16_t value;
 } plm_vlc_uint_t;
 
+// Direct lookup tables for the VLC trees above. The first (up to)
+// PLM_VLC_LOOKUP_BITS bits of a code index the table. Entries with a length
+// > 0 are complete codes of that length; entries with length 0 hold the tree
+// index after the first lookup bits and are resolved by walking the tree.
+
+#define PLM_VLC_LOOKUP_BITS 9
+
+typedef struct {
+	int16_t value;
+	int16_t length;
+} plm_vlc_lookup_entry_t;
+
+typedef struct {
+	const plm_vlc_t *tree;
+	int bits;
+	plm_vlc_lookup_entry_t entries[1 << PLM_VLC_LOOKUP_BITS];
+} plm_vlc_lookup_t;
+
 
+void plm_mapped_file_register(uint8_t *bytes, size_t length);
+void plm_mapped_file_unregister(uint8_t *bytes);
 void plm_buffer_seek(plm_buffer_t *self, size_t pos);
 size_t plm_buffer_tell(plm_buffer_t *self);
 void plm_buffer_discard_read_bytes(plm_buffer_t *self);
+void plm_buffer_release_read_bytes(plm_buffer_t *self);
+void plm_buffer_reclaim_read_bytes(plm_buffer_t *self);
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user);
 
 int plm_buffer_has(plm_buffer_t *self, size_t count);
 int plm_buffer_read(plm_buffer_t *self, int count);
+int plm_buffer_read_bits(plm_buffer_t *self, int count);
 void plm_buffer_align(plm_buffer_t *self);
 void plm_buffer_skip(plm_buffer_t *self, size_t count);
 int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v);
+size_t plm_buffer_scan_start_code(const uint8_t *bytes, size_t index, size_t end);
+size_t plm_buffer_scan_start_code_scalar(const uint8_t *bytes, size_t index, size_t end);
 int plm_buffer_next_start_code(plm_buffer_t *self);
 int plm_buffer_find_start_code(plm_buffer_t *self, int code);
 int plm_buffer_no_start_code(plm_buffer_t *self);
 int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table);
 uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table);
+int16_t plm_buffer_read_vlc_lookup(plm_buffer_t *self, const plm_vlc_lookup_t *lookup);
+uint16_t plm_buffer_read_vlc_lookup_uint(plm_buffer_t *self, const plm_vlc_lookup_t *lookup);
+
+int plm_vlc_tree_depth(const plm_vlc_t *tree, int index);
+void plm_vlc_lookup_init(plm_vlc_lookup_t *self, const plm_vlc_t *tree);
 
 plm_buffer_t *plm_buffer_create_with_filename(const char *filename) {
 	FILE *fh = fopen(filename, "rb");
@@ -1392,36 +1982,194 @@ plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int f
 	self->bytes = bytes;
 	self->mode = PLM_BUFFER_MODE_FIXED_MEM;
 	self->discard_read_bytes = FALSE;
+	self->scan_code = -1;
 	return self;
 }
 
-plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity) {
-	plm_buffer_t *self = (plm_buffer_t *)malloc(sizeof(plm_buffer_t));
-	memset(self, 0, sizeof(plm_buffer_t));
-	self->capacity = capacity;
-	self->free_when_done = TRUE;
-	self->bytes = (uint8_t *)malloc(capacity);
-	self->mode = PLM_BUFFER_MODE_RING;
-	self->discard_read_bytes = TRUE;
-	return self;
-}
+plm_buffer_t *plm_buffer_create_with_mapped_file(const char *filename) {
+	#if defined(PLM_MMAP)
+		int fd = open(filename, O_RDONLY);
+		if (fd == -1) {
+			return NULL;
+		}
 
-plm_buffer_t *plm_buffer_create_for_appending(size_t initial_capacity) {
-	plm_buffer_t *self = plm_buffer_create_with_capacity(initial_capacity);
-	self->mode = PLM_BUFFER_MODE_APPEND;
-	self->discard_read_bytes = FALSE;
-	return self;
-}
+		struct stat st;
+		void *bytes = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			bytes = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close(fd);
 
-void plm_buffer_destroy(plm_buffer_t *self) {
-	if (self->fh && self->close_when_done) {
-		fclose(self->fh);
-	}
-	if (self->free_when_done) {
-		free(self->bytes);
-	}
-	free(self);
-}
+		if (bytes == MAP_FAILED) {
+			return NULL;
+		}
+
+		#if defined(MADV_SEQUENTIAL)
+			madvise(bytes, st.st_size, MADV_SEQUENTIAL);
+		#endif
+
+		plm_buffer_t *self = plm_buffer_create_with_memory((uint8_t *)bytes, st.st_size, FALSE);
+		self->mapped_length = st.st_size;
+		plm_mapped_file_register(self->bytes, self->mapped_length);
+		return self;
+	#else
+		PLM_UNUSED(filename);
+		return NULL;
+	#endif
+}
+
+#if defined(PLM_MMAP_GUARD)
+
+// The mapped files as seen by the SIGBUS handler. A slot is claimed by setting
+// its length and then published by setting its bytes, so the handler never
+// sees bytes without their length.
+
+typedef struct {
+	uint8_t *volatile bytes;
+	volatile size_t length;
+} plm_mapped_file_slot_t;
+
+static plm_mapped_file_slot_t plm_mapped_file_slots[PLM_MMAP_GUARD_SLOTS];
+static struct sigaction plm_mapped_file_previous_action;
+static volatile int plm_mapped_file_guarded = FALSE;
+static volatile int plm_mapped_file_faults = 0;
+static size_t plm_mapped_file_page_size = 0;
+
+// Runs in signal context. mmap() is not on the POSIX list of async-signal-safe
+// functions, but is a bare system call on the systems this is meant for.
+
+void plm_mapped_file_on_sigbus(int sig, siginfo_t *info, void *context) {
+	PLM_UNUSED(sig);
+	PLM_UNUSED(context);
+
+	uint8_t *addr = (uint8_t *)info->si_addr;
+	for (int i = 0; info->si_code > 0 && i < PLM_MMAP_GUARD_SLOTS; i++) {
+		uint8_t *bytes = plm_mapped_file_slots[i].bytes;
+		size_t length = plm_mapped_file_slots[i].length;
+		if (!bytes || addr < bytes || addr >= bytes + length) {
+			continue;
+		}
+
+		// Replace everything from the faulting page on with zeros; the read
+		// is retried once the handler returns.
+		size_t offset = (size_t)(addr - bytes) & ~(plm_mapped_file_page_size - 1);
+		void *zeros = mmap(
+			bytes + offset, length - offset, PROT_READ,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0
+		);
+		if (zeros != MAP_FAILED) {
+			__sync_fetch_and_add(&plm_mapped_file_faults, 1);
+			return;
+		}
+	}
+
+	// Not ours; hand the fault back to the previous handler, which gets it
+	// when the read is retried (or right away, if it was sent).
+	sigaction(SIGBUS, &plm_mapped_file_previous_action, NULL);
+	plm_mapped_file_guarded = FALSE;
+	if (info->si_code <= 0) {
+		raise(SIGBUS);
+	}
+}
+
+#endif
+
+void plm_mapped_file_register(uint8_t *bytes, size_t length) {
+	#if defined(PLM_MMAP_GUARD)
+		for (int i = 0; i < PLM_MMAP_GUARD_SLOTS; i++) {
+			if (__sync_bool_compare_and_swap(&plm_mapped_file_slots[i].length, 0, length)) {
+				__sync_synchronize();
+				plm_mapped_file_slots[i].bytes = bytes;
+				return;
+			}
+		}
+	#else
+		PLM_UNUSED(bytes);
+		PLM_UNUSED(length);
+	#endif
+}
+
+void plm_mapped_file_unregister(uint8_t *bytes) {
+	#if defined(PLM_MMAP_GUARD)
+		for (int i = 0; i < PLM_MMAP_GUARD_SLOTS; i++) {
+			if (plm_mapped_file_slots[i].bytes == bytes) {
+				plm_mapped_file_slots[i].bytes = NULL;
+				__sync_synchronize();
+				plm_mapped_file_slots[i].length = 0;
+				return;
+			}
+		}
+	#else
+		PLM_UNUSED(bytes);
+	#endif
+}
+
+int plm_guard_mapped_files(void) {
+	#if defined(PLM_MMAP_GUARD)
+		if (plm_mapped_file_guarded) {
+			return TRUE;
+		}
+
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = plm_mapped_file_on_sigbus;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+
+		plm_mapped_file_page_size = sysconf(_SC_PAGESIZE);
+		if (sigaction(SIGBUS, &action, &plm_mapped_file_previous_action) != 0) {
+			return FALSE;
+		}
+		plm_mapped_file_guarded = TRUE;
+		return TRUE;
+	#else
+		return FALSE;
+	#endif
+}
+
+int plm_get_mapped_file_faults(void) {
+	#if defined(PLM_MMAP_GUARD)
+		return plm_mapped_file_faults;
+	#else
+		return 0;
+	#endif
+}
+
+plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity) {
+	plm_buffer_t *self = (plm_buffer_t *)malloc(sizeof(plm_buffer_t));
+	memset(self, 0, sizeof(plm_buffer_t));
+	self->capacity = capacity;
+	self->tail_padding = PLM_BUFFER_TAIL_PADDING;
+	self->free_when_done = TRUE;
+	self->bytes = (uint8_t *)malloc(capacity + PLM_BUFFER_TAIL_PADDING);
+	self->mode = PLM_BUFFER_MODE_RING;
+	self->discard_read_bytes = TRUE;
+	self->scan_code = -1;
+	return self;
+}
+
+plm_buffer_t *plm_buffer_create_for_appending(size_t initial_capacity) {
+	plm_buffer_t *self = plm_buffer_create_with_capacity(initial_capacity);
+	self->mode = PLM_BUFFER_MODE_APPEND;
+	self->discard_read_bytes = FALSE;
+	return self;
+}
+
+void plm_buffer_destroy(plm_buffer_t *self) {
+	if (self->fh && self->close_when_done) {
+		fclose(self->fh);
+	}
+	#if defined(PLM_MMAP)
+		if (self->mapped_length) {
+			plm_mapped_file_unregister(self->bytes);
+			munmap(self->bytes, self->mapped_length);
+		}
+	#endif
+	if (self->free_when_done) {
+		free(self->bytes);
+	}
+	free(self);
+}
 
 size_t plm_buffer_get_size(plm_buffer_t *self) {
 	return (self->mode == PLM_BUFFER_MODE_FILE)
@@ -1439,11 +2187,15 @@ size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
 	}
 
 	if (self->discard_read_bytes) {
-		// This should be a ring buffer, but instead it just shifts all unread 
-		// data to the beginning of the buffer and appends new data at the end. 
-		// Seems to be good enough.
-
-		plm_buffer_discard_read_bytes(self);
+		// Unread data is only shifted to the beginning of the buffer once the
+		// new data does not fit at the end anymore, rather than on every write.
+		// The bit reader needs the bytes to be contiguous, so this stands in
+		// for a ring buffer; between two shifts a buffer's worth of data is
+		// appended, while only what is left unread of it is moved.
+
+		if (self->capacity - self->length < length) {
+			plm_buffer_discard_read_bytes(self);
+		}
 		if (self->mode == PLM_BUFFER_MODE_RING) {
 			self->total_size = 0;
 		}
@@ -1456,7 +2208,7 @@ size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
 		do {
 			new_size *= 2;
 		} while (new_size - self->length < length);
-		self->bytes = (uint8_t *)realloc(self->bytes, new_size);
+		self->bytes = (uint8_t *)realloc(self->bytes, new_size + PLM_BUFFER_TAIL_PADDING);
 		self->capacity = new_size;
 	}
 
@@ -1481,6 +2233,7 @@ void plm_buffer_rewind(plm_buffer_t *self) {
 
 void plm_buffer_seek(plm_buffer_t *self, size_t pos) {
 	self->has_ended = FALSE;
+	self->scan_code = -1;
 
 	if (self->mode == PLM_BUFFER_MODE_FILE) {
 		fseek(self->fh, pos, SEEK_SET);
@@ -1508,7 +2261,21 @@ size_t plm_buffer_tell(plm_buffer_t *self) {
 }
 
 void plm_buffer_discard_read_bytes(plm_buffer_t *self) {
+	// Mapped files are read-only; release the pages instead
+	if (self->mapped_length) {
+		plm_buffer_reclaim_read_bytes(self);
+		return;
+	}
+
 	size_t byte_pos = self->bit_index >> 3;
+	if (self->scan_from >= byte_pos) {
+		self->scan_from -= byte_pos;
+		self->scan_index -= byte_pos;
+	}
+	else {
+		self->scan_code = -1;
+	}
+
 	if (byte_pos == self->length) {
 		self->bit_index = 0;
 		self->length = 0;
@@ -1520,6 +2287,42 @@ void plm_buffer_discard_read_bytes(plm_buffer_t *self) {
 	}
 }
 
+void plm_buffer_release_read_bytes(plm_buffer_t *self) {
+	// Files have a fixed capacity, which has to be free for the next picture.
+	// Growing buffers only shift their unread data down once the read bytes
+	// take up half of them, i.e. every few pictures instead of before each.
+	// Memory buffers are never shifted, as they may be seeked in. This is
+	// what stands in for a ring buffer: the bit reader needs the data to be
+	// contiguous, so it can not wrap around.
+	if (self->mapped_length) {
+		plm_buffer_reclaim_read_bytes(self);
+	}
+	else if (
+		self->mode == PLM_BUFFER_MODE_FILE || (
+			self->discard_read_bytes &&
+			(self->bit_index >> 3) >= self->capacity / 2
+		)
+	) {
+		plm_buffer_discard_read_bytes(self);
+	}
+}
+
+void plm_buffer_reclaim_read_bytes(plm_buffer_t *self) {
+	if (!self->mapped_length) {
+		return;
+	}
+
+	size_t end = (self->bit_index >> 3) / PLM_BUFFER_RECLAIM_SIZE * PLM_BUFFER_RECLAIM_SIZE;
+	if (end > self->reclaimed_index) {
+		#if defined(MADV_DONTNEED)
+			madvise(self->bytes + self->reclaimed_index, end - self->reclaimed_index, MADV_DONTNEED);
+		#endif
+	}
+
+	// After seeking backwards, reclaim again from the new position
+	self->reclaimed_index = end;
+}
+
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user) {
 	PLM_UNUSED(user);
 	
@@ -1559,7 +2362,46 @@ int plm_buffer_has(plm_buffer_t *self, size_t count) {
 	return FALSE;
 }
 
+static inline uint64_t plm_buffer_load_64(const uint8_t *bytes) {
+	uint64_t word;
+	memcpy(&word, bytes, sizeof(word));
+	#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		word = __builtin_bswap64(word);
+	#elif !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+		word =
+			((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) |
+			((uint64_t)bytes[2] << 40) | ((uint64_t)bytes[3] << 32) |
+			((uint64_t)bytes[4] << 24) | ((uint64_t)bytes[5] << 16) |
+			((uint64_t)bytes[6] << 8) | (uint64_t)bytes[7];
+	#endif
+	return word;
+}
+
+// Returns TRUE if count bits are available and a 64 bit word can be loaded
+// from the current byte without running past the (padded) end of the buffer.
+// The 64 bit word always covers reads of up to 32 bits at any bit offset.
+
+static inline int plm_buffer_has_word(plm_buffer_t *self, size_t count) {
+	return
+		(self->bit_index >> 3) + 8 <= self->length + self->tail_padding &&
+		self->bit_index + count <= (self->length << 3);
+}
+
 int plm_buffer_read(plm_buffer_t *self, int count) {
+	// A 64 bit word can not be shifted by 64
+	if (count == 0) {
+		return 0;
+	}
+	if (plm_buffer_has_word(self, count)) {
+		uint64_t word = plm_buffer_load_64(self->bytes + (self->bit_index >> 3));
+		int shift = 64 - (int)(self->bit_index & 7) - count;
+		self->bit_index += count;
+		return (int)((word >> shift) & (((uint64_t)1 << count) - 1));
+	}
+	return plm_buffer_read_bits(self, count);
+}
+
+int plm_buffer_read_bits(plm_buffer_t *self, int count) {
 	if (!plm_buffer_has(self, count)) {
 		return 0;
 	}
@@ -1602,33 +2444,142 @@ int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v) {
 	return skipped;
 }
 
+// Returns the index of the first 0x00 0x00 0x01 start code prefix at or after
+// index and before end, or end if there is none. The two bytes following end
+// have to be readable.
+
+size_t plm_buffer_scan_start_code_scalar(const uint8_t *bytes, size_t index, size_t end) {
+	while (index < end) {
+		// A third byte > 1 rules out a prefix starting at any of these three
+		if (bytes[index + 2] > 0x01) {
+			index += 3;
+		}
+		else if (
+			bytes[index] == 0x00 &&
+			bytes[index + 1] == 0x00 &&
+			bytes[index + 2] == 0x01
+		) {
+			return index;
+		}
+		else {
+			index++;
+		}
+	}
+	return end;
+}
+
+#ifdef PLM_SIMD_X86
+
+PLM_SIMD_TARGET("sse2")
+size_t plm_buffer_scan_start_code_sse2(const uint8_t *bytes, size_t index, size_t end) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi8(1);
+	for (; index + 16 <= end; index += 16) {
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(bytes + index));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(bytes + index + 1));
+		__m128i b2 = _mm_loadu_si128((const __m128i *)(bytes + index + 2));
+		int mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+			_mm_cmpeq_epi8(b2, one)
+		));
+		if (mask) {
+			return index + __builtin_ctz(mask);
+		}
+	}
+	return plm_buffer_scan_start_code_scalar(bytes, index, end);
+}
+
+#endif // PLM_SIMD_X86
+
+#ifdef PLM_SIMD_NEON
+
+size_t plm_buffer_scan_start_code_neon(const uint8_t *bytes, size_t index, size_t end) {
+	uint8x16_t zero = vdupq_n_u8(0);
+	uint8x16_t one = vdupq_n_u8(1);
+	for (; index + 16 <= end; index += 16) {
+		uint8x16_t match = vandq_u8(
+			vandq_u8(vceqq_u8(vld1q_u8(bytes + index), zero), vceqq_u8(vld1q_u8(bytes + index + 1), zero)),
+			vceqq_u8(vld1q_u8(bytes + index + 2), one)
+		);
+
+		// Narrow the 16 byte mask to 64 bits, 4 per byte, to test it at once
+		uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(match), 4);
+		if (vget_lane_u64(vreinterpret_u64_u8(narrowed), 0)) {
+			return plm_buffer_scan_start_code_scalar(bytes, index, index + 16);
+		}
+	}
+	return plm_buffer_scan_start_code_scalar(bytes, index, end);
+}
+
+#endif // PLM_SIMD_NEON
+
+size_t plm_buffer_scan_start_code(const uint8_t *bytes, size_t index, size_t end) {
+	int features = plm_cpu_features();
+	PLM_UNUSED(features);
+
+	#if defined(PLM_SIMD_X86)
+		if (features & PLM_CPU_SSE2) {
+			return plm_buffer_scan_start_code_sse2(bytes, index, end);
+		}
+	#elif defined(PLM_SIMD_NEON)
+		if (features & PLM_CPU_NEON) {
+			return plm_buffer_scan_start_code_neon(bytes, index, end);
+		}
+	#endif
+
+	return plm_buffer_scan_start_code_scalar(bytes, index, end);
+}
+
 int plm_buffer_next_start_code(plm_buffer_t *self) {
 	plm_buffer_align(self);
 
+	// A start code is only accepted with at least one byte following it
 	while (plm_buffer_has(self, (5 << 3))) {
-		size_t byte_index = (self->bit_index) >> 3;
-		if (
-			self->bytes[byte_index] == 0x00 &&
-			self->bytes[byte_index + 1] == 0x00 &&
-			self->bytes[byte_index + 2] == 0x01
-		) {
+		size_t end = self->length - 4;
+		size_t byte_index = plm_buffer_scan_start_code(self->bytes, self->bit_index >> 3, end);
+		if (byte_index != end) {
 			self->bit_index = (byte_index + 4) << 3;
 			return self->bytes[byte_index + 3];
 		}
-		self->bit_index += 8;
+		self->bit_index = end << 3;
 	}
 	return -1;
 }
 
 int plm_buffer_find_start_code(plm_buffer_t *self, int code) {
+	plm_buffer_align(self);
+	size_t from = self->bit_index >> 3;
+
+	// Picking up where the last search for the same code from here left off
+	// spares scanning the data twice, i.e. for a picture that was found by
+	// plm_buffer_has_start_code() or that was not complete yet.
+	if (self->scan_code == code && self->scan_from == from) {
+		if (self->scan_found) {
+			self->bit_index = (self->scan_index + 4) << 3;
+			return code;
+		}
+		self->bit_index = self->scan_index << 3;
+	}
+
+	self->scan_code = code;
+	self->scan_from = from;
+
 	int current = 0;
 	while (TRUE) {
 		current = plm_buffer_next_start_code(self);
 		if (current == code || current == -1) {
-			return current;
+			break;
 		}
 	}
-	return -1;
+
+	// Unless the data searched has been discarded in the meantime
+	if (self->scan_code == code) {
+		self->scan_found = (current != -1);
+		self->scan_index = self->scan_found
+			? (self->bit_index >> 3) - 4
+			: self->bit_index >> 3;
+	}
+	return current;
 }
 
 int plm_buffer_has_start_code(plm_buffer_t *self, int code) {
@@ -1655,6 +2606,22 @@ int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
 
 int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table) {
 	plm_vlc_t state = {0, 0};
+
+	// No VLC used by MPEG1 is longer than 32 bits, so the tree can be walked
+	// on a single word when enough data is available.
+	if (plm_buffer_has_word(self, 32)) {
+		uint64_t word = plm_buffer_load_64(self->bytes + (self->bit_index >> 3));
+		word <<= self->bit_index & 7;
+		int read = 0;
+		do {
+			state = table[state.index + (int)(word >> 63)];
+			word <<= 1;
+			read++;
+		} while (state.index > 0);
+		self->bit_index += read;
+		return state.value;
+	}
+
 	do {
 		state = table[state.index + plm_buffer_read(self, 1)];
 	} while (state.index > 0);
@@ -1665,6 +2632,75 @@ uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *tabl
 	return (uint16_t)plm_buffer_read_vlc(self, (const plm_vlc_t *)table);
 }
 
+int16_t plm_buffer_read_vlc_lookup(plm_buffer_t *self, const plm_vlc_lookup_t *lookup) {
+	if (!plm_buffer_has_word(self, 32)) {
+		return plm_buffer_read_vlc(self, lookup->tree);
+	}
+
+	uint64_t word = plm_buffer_load_64(self->bytes + (self->bit_index >> 3));
+	word <<= self->bit_index & 7;
+
+	plm_vlc_lookup_entry_t entry = lookup->entries[word >> (64 - lookup->bits)];
+	if (entry.length > 0) {
+		self->bit_index += entry.length;
+		return entry.value;
+	}
+
+	// Second level: continue in the tree after the first lookup bits
+	plm_vlc_t state = {entry.value, 0};
+	int read = lookup->bits;
+	word <<= read;
+	do {
+		state = lookup->tree[state.index + (int)(word >> 63)];
+		word <<= 1;
+		read++;
+	} while (state.index > 0);
+	self->bit_index += read;
+	return state.value;
+}
+
+uint16_t plm_buffer_read_vlc_lookup_uint(plm_buffer_t *self, const plm_vlc_lookup_t *lookup) {
+	return (uint16_t)plm_buffer_read_vlc_lookup(self, lookup);
+}
+
+int plm_vlc_tree_depth(const plm_vlc_t *tree, int index) {
+	int depth = 0;
+	for (int bit = 0; bit < 2; bit++) {
+		int d = tree[index + bit].index > 0
+			? plm_vlc_tree_depth(tree, tree[index + bit].index)
+			: 0;
+		if (d + 1 > depth) {
+			depth = d + 1;
+		}
+	}
+	return depth;
+}
+
+void plm_vlc_lookup_init(plm_vlc_lookup_t *self, const plm_vlc_t *tree) {
+	int depth = plm_vlc_tree_depth(tree, 0);
+	self->tree = tree;
+	self->bits = depth < PLM_VLC_LOOKUP_BITS ? depth : PLM_VLC_LOOKUP_BITS;
+
+	for (int code = 0; code < (1 << self->bits); code++) {
+		plm_vlc_t state = {0, 0};
+		int length = 0;
+		do {
+			int bit = (code >> (self->bits - 1 - length)) & 1;
+			state = tree[state.index + bit];
+			length++;
+		} while (state.index > 0 && length < self->bits);
+
+		if (state.index > 0) {
+			self->entries[code].value = state.index;
+			self->entries[code].length = 0;
+		}
+		else {
+			self->entries[code].value = state.value;
+			self->entries[code].length = length;
+		}
+	}
+}
+
 
 
 // ----------------------------------------------------------------------------
@@ -1674,6 +2710,22 @@ static const int PLM_START_PACK = 0xBA;
 static const int PLM_START_END = 0xB9;
 static const int PLM_START_SYSTEM = 0xBB;
 
+typedef struct {
+	double pts;
+	size_t offset;
+} plm_demux_index_entry_t;
+
+typedef struct {
+	char magic[4];
+	int type;
+	uint64_t file_size;
+	double start_time;
+	double duration;
+	uint64_t index_length;
+} plm_demux_index_header_t;
+
+static const char PLM_DEMUX_INDEX_MAGIC[4] = {'P', 'L', 'M', 'I'};
+
 struct plm_demux_t {
 	plm_buffer_t *buffer;
 	int destroy_buffer_when_done;
@@ -1693,6 +2745,12 @@ struct plm_demux_t {
 	int num_video_streams;
 	plm_packet_t current_packet;
 	plm_packet_t next_packet;
+
+	plm_demux_index_entry_t *index;
+	int index_length;
+	int index_capacity;
+	int index_type;
+	size_t index_file_size;
 };
 
 
@@ -1700,6 +2758,8 @@ void plm_demux_buffer_seek(plm_demux_t *self, size_t pos);
 double plm_demux_decode_time(plm_demux_t *self);
 plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type);
 plm_packet_t *plm_demux_get_packet(plm_demux_t *self);
+int plm_demux_packet_is_intra(plm_packet_t *packet);
+plm_packet_t *plm_demux_seek_index(plm_demux_t *self, double seek_time, int type);
 
 plm_demux_t *plm_demux_create(plm_buffer_t *buffer, int destroy_when_done) {
 	plm_demux_t *self = (plm_demux_t *)malloc(sizeof(plm_demux_t));
@@ -1720,6 +2780,9 @@ void plm_demux_destroy(plm_demux_t *self) {
 	if (self->destroy_buffer_when_done) {
 		plm_buffer_destroy(self->buffer);
 	}
+	if (self->index) {
+		free(self->index);
+	}
 	free(self);
 }
 
@@ -1919,6 +2982,15 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
 	}
 	seek_time += self->start_time;
 
+	if (
+		force_intra &&
+		self->index_length &&
+		self->index_type == type &&
+		self->index_file_size == (size_t)file_size
+	) {
+		return plm_demux_seek_index(self, seek_time, type);
+	}
+
 	for (int retry = 0; retry < 32; retry++) {
 		int found_packet_with_pts = FALSE;
 		int found_packet_in_range = FALSE;
@@ -1976,21 +3048,8 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
 			// later, when we know it's the last intra frame before desired
 			// seek time.
 			if (force_intra) {
-				for (size_t i = 0; i < packet->length - 6; i++) {
-					// Find the START_PICTURE code
-					if (
-						packet->data[i] == 0x00 &&
-						packet->data[i + 1] == 0x00 &&
-						packet->data[i + 2] == 0x01 &&
-						packet->data[i + 3] == 0x00
-					) {
-						// Bits 11--13 in the picture header contain the frame 
-						// type, where 1=Intra
-						if ((packet->data[i + 5] & 0x38) == 8) {
-							last_valid_packet_start = packet_start;
-						}
-						break;
-					}
+				if (plm_demux_packet_is_intra(packet)) {
+					last_valid_packet_start = packet_start;
 				}
 			}
 
@@ -2026,59 +3085,345 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
 	return NULL;
 }
 
-plm_packet_t *plm_demux_decode(plm_demux_t *self) {
-	if (!plm_demux_has_headers(self)) {
-		return NULL;
-	}
-
-	if (self->current_packet.length) {
-		size_t bits_till_next_packet = self->current_packet.length << 3;
-		if (!plm_buffer_has(self->buffer, bits_till_next_packet)) {
-			return NULL;
+plm_packet_t *plm_demux_seek_index(plm_demux_t *self, double seek_time, int type) {
+	// Find the last intra frame at or before the seek_time. If there is none,
+	// the first one is the best we can do.
+	int low = 0;
+	int high = self->index_length;
+	while (low < high) {
+		int mid = (low + high) >> 1;
+		if (self->index[mid].pts <= seek_time) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
 		}
-		plm_buffer_skip(self->buffer, bits_till_next_packet);
-		self->current_packet.length = 0;
 	}
 
-	// Pending packet waiting for data?
-	if (self->next_packet.length) {
-		return plm_demux_get_packet(self);
-	}
+	plm_demux_index_entry_t *entry = &self->index[low > 0 ? low - 1 : 0];
+	plm_demux_buffer_seek(self, entry->offset);
+	return plm_demux_decode_packet(self, type);
+}
 
-	// Pending packet waiting for header?
-	if (self->start_code != -1) {
-		return plm_demux_decode_packet(self, self->start_code);
+int plm_demux_build_index(plm_demux_t *self, int type) {
+	self->index_length = 0;
+
+	// Ring buffers can not seek back after the scan
+	if (!plm_demux_has_headers(self) || self->buffer->mode == PLM_BUFFER_MODE_RING) {
+		return 0;
 	}
 
-	do {
-		self->start_code = plm_buffer_next_start_code(self->buffer);
+	size_t previous_pos = plm_buffer_tell(self->buffer);
+	int previous_start_code = self->start_code;
+	plm_packet_t previous_current_packet = self->current_packet;
+	plm_packet_t previous_next_packet = self->next_packet;
+
+	// Scan through all packets and record the ones starting an intra frame. 
+	// PTS of intra frames only ever increase, so the index stays sorted; 
+	// anything else (i.e. a broken or concatenated file) is left out.
+	double first_pts = PLM_PACKET_INVALID_TS;
+	double packet_pts = PLM_PACKET_INVALID_TS;
+	double last_pts = PLM_PACKET_INVALID_TS;
+
+	plm_demux_buffer_seek(self, 0);
+	while (plm_buffer_find_start_code(self->buffer, type) != -1) {
+		size_t packet_start = plm_buffer_tell(self->buffer);
+		plm_packet_t *packet = plm_demux_decode_packet(self, type);
+
+		if (packet) {
+			// Skip the payload, so that a start code at its very end does not
+			// swallow the header of the next packet.
+			plm_buffer_skip(self->buffer, packet->length << 3);
+
+			if (packet->pts != PLM_PACKET_INVALID_TS) {
+				if (first_pts == PLM_PACKET_INVALID_TS) {
+					first_pts = packet->pts;
+				}
+				packet_pts = packet->pts;
+			}
+		}
+
 		if (
-			self->start_code == PLM_DEMUX_PACKET_VIDEO_1 || 
-			self->start_code == PLM_DEMUX_PACKET_PRIVATE || (
-				self->start_code >= PLM_DEMUX_PACKET_AUDIO_1 && 
-				self->start_code <= PLM_DEMUX_PACKET_AUDIO_4
-			)
+			!packet ||
+			packet->pts == PLM_PACKET_INVALID_TS ||
+			(last_pts != PLM_PACKET_INVALID_TS && packet->pts <= last_pts) ||
+			!plm_demux_packet_is_intra(packet)
 		) {
-			return plm_demux_decode_packet(self, self->start_code);
+			continue;
 		}
-	} while (self->start_code != -1);
 
-	return NULL;
-}
-
-double plm_demux_decode_time(plm_demux_t *self) {
-	int64_t clock = plm_buffer_read(self->buffer, 3) << 30;
-	plm_buffer_skip(self->buffer, 1);
-	clock |= plm_buffer_read(self->buffer, 15) << 15;
-	plm_buffer_skip(self->buffer, 1);
-	clock |= plm_buffer_read(self->buffer, 15);
-	plm_buffer_skip(self->buffer, 1);
-	return (double)clock / 90000.0;
-}
+		if (self->index_length == self->index_capacity) {
+			self->index_capacity = self->index_capacity ? self->index_capacity * 2 : 256;
+			self->index = (plm_demux_index_entry_t *)realloc(
+				self->index, self->index_capacity * sizeof(plm_demux_index_entry_t)
+			);
+		}
 
-plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type) {
-	if (!plm_buffer_has(self->buffer, 16 << 3)) {
-		return NULL;
+		self->index[self->index_length].pts = packet->pts;
+		self->index[self->index_length].offset = packet_start;
+		self->index_length++;
+		last_pts = packet->pts;
+	}
+
+	self->index_type = type;
+	self->index_file_size = plm_buffer_get_size(self->buffer);
+
+	// The duration comes for free after reading through everything
+	if (first_pts != PLM_PACKET_INVALID_TS) {
+		if (self->start_time == PLM_PACKET_INVALID_TS) {
+			self->start_time = first_pts;
+		}
+		self->duration = packet_pts - self->start_time;
+		self->last_file_size = self->index_file_size;
+	}
+
+	plm_demux_buffer_seek(self, previous_pos);
+	self->start_code = previous_start_code;
+	self->current_packet = previous_current_packet;
+	self->next_packet = previous_next_packet;
+	return self->index_length;
+}
+
+// Demux all packets of the given type at once into a memory buffer holding
+// their payloads back to back, i.e. the elementary stream. Also returns the PTS
+// of the intra pictures along with their offsets in that stream.
+
+plm_buffer_t *plm_demux_extract(plm_demux_t *self, int type, plm_pts_entry_t **pts_out, int *pts_length_out) {
+	// Ring buffers can not seek back after demuxing
+	if (!plm_demux_has_headers(self) || self->buffer->mode == PLM_BUFFER_MODE_RING) {
+		return NULL;
+	}
+
+	size_t capacity = PLM_BUFFER_DEFAULT_SIZE;
+	size_t length = 0;
+	uint8_t *bytes = (uint8_t *)malloc(capacity + PLM_BUFFER_TAIL_PADDING);
+
+	plm_pts_entry_t *pts = NULL;
+	int pts_length = 0;
+	int pts_capacity = 0;
+	double first_pts = PLM_PACKET_INVALID_TS;
+	double last_pts = PLM_PACKET_INVALID_TS;
+
+	// Record where each packet starting an intra picture ends up in the 
+	// elementary stream. As with the seek index, the PTS only ever increase.
+	plm_demux_rewind(self);
+	plm_packet_t *packet;
+	while ((packet = plm_demux_decode(self))) {
+		if (packet->type != type) {
+			continue;
+		}
+
+		if (packet->pts != PLM_PACKET_INVALID_TS) {
+			if (first_pts == PLM_PACKET_INVALID_TS) {
+				first_pts = packet->pts;
+			}
+			last_pts = packet->pts;
+
+			if (
+				plm_demux_packet_is_intra(packet) &&
+				(pts_length == 0 || packet->pts > pts[pts_length - 1].pts)
+			) {
+				if (pts_length == pts_capacity) {
+					pts_capacity = pts_capacity ? pts_capacity * 2 : 256;
+					pts = (plm_pts_entry_t *)realloc(pts, pts_capacity * sizeof(plm_pts_entry_t));
+				}
+				pts[pts_length].pts = packet->pts;
+				pts[pts_length].offset = length;
+				pts_length++;
+			}
+		}
+
+		if (capacity - length < packet->length) {
+			do {
+				capacity *= 2;
+			} while (capacity - length < packet->length);
+			bytes = (uint8_t *)realloc(bytes, capacity + PLM_BUFFER_TAIL_PADDING);
+		}
+
+		memcpy(bytes + length, packet->data, packet->length);
+		length += packet->length;
+	}
+	plm_demux_rewind(self);
+
+	if (length == 0) {
+		free(bytes);
+		free(pts);
+		return NULL;
+	}
+
+	// The duration comes for free after reading through everything
+	if (first_pts != PLM_PACKET_INVALID_TS) {
+		if (self->start_time == PLM_PACKET_INVALID_TS) {
+			self->start_time = first_pts;
+		}
+		self->duration = last_pts - self->start_time;
+		self->last_file_size = plm_buffer_get_size(self->buffer);
+	}
+
+	plm_buffer_t *buffer = plm_buffer_create_with_memory(bytes, length, TRUE);
+	buffer->tail_padding = PLM_BUFFER_TAIL_PADDING;
+
+	*pts_out = pts;
+	*pts_length_out = pts_length;
+	return buffer;
+}
+
+size_t plm_demux_get_index(plm_demux_t *self, int type, void *data, size_t size) {
+	size_t file_size = plm_buffer_get_size(self->buffer);
+	int index_length = (
+		self->index_type == type &&
+		self->index_file_size == file_size
+	) ? self->index_length : 0;
+
+	size_t index_size = index_length * sizeof(plm_demux_index_entry_t);
+	size_t needed = sizeof(plm_demux_index_header_t) + index_size;
+	if (!data || size < needed) {
+		return needed;
+	}
+
+	plm_demux_index_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PLM_DEMUX_INDEX_MAGIC, sizeof(header.magic));
+	header.type = type;
+	header.file_size = file_size;
+	header.start_time = plm_demux_get_start_time(self, type);
+	header.duration = plm_demux_get_duration(self, type);
+	header.index_length = index_length;
+
+	memcpy(data, &header, sizeof(header));
+	if (index_size) {
+		memcpy((uint8_t *)data + sizeof(header), self->index, index_size);
+	}
+	return needed;
+}
+
+int plm_demux_set_index(plm_demux_t *self, int type, const void *data, size_t size) {
+	plm_demux_index_header_t header;
+	if (!data || size < sizeof(header)) {
+		return -1;
+	}
+
+	memcpy(&header, data, sizeof(header));
+	size_t file_size = plm_buffer_get_size(self->buffer);
+	if (
+		memcmp(header.magic, PLM_DEMUX_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+		header.type != type ||
+		header.file_size != file_size ||
+		header.index_length > (size - sizeof(header)) / sizeof(plm_demux_index_entry_t) ||
+		size != sizeof(header) + header.index_length * sizeof(plm_demux_index_entry_t)
+	) {
+		return -1;
+	}
+
+	// Seeking bisects the entries and jumps to their offsets, so they have to
+	// lie within the data source and be in order.
+	int index_length = (int)header.index_length;
+	const uint8_t *entries = (const uint8_t *)data + sizeof(header);
+	plm_demux_index_entry_t previous = {0, 0};
+	for (int i = 0; i < index_length; i++) {
+		plm_demux_index_entry_t entry;
+		memcpy(&entry, entries + i * sizeof(plm_demux_index_entry_t), sizeof(entry));
+		if (
+			entry.offset >= file_size ||
+			(i > 0 && (entry.offset < previous.offset || !(entry.pts >= previous.pts))) ||
+			entry.pts != entry.pts
+		) {
+			return -1;
+		}
+		previous = entry;
+	}
+
+	if (index_length > self->index_capacity) {
+		self->index_capacity = index_length;
+		self->index = (plm_demux_index_entry_t *)realloc(
+			self->index, self->index_capacity * sizeof(plm_demux_index_entry_t)
+		);
+	}
+
+	if (index_length) {
+		memcpy(self->index, entries, index_length * sizeof(plm_demux_index_entry_t));
+	}
+	self->index_length = index_length;
+	self->index_type = type;
+	self->index_file_size = file_size;
+
+	self->start_time = header.start_time;
+	self->duration = header.duration;
+	self->last_file_size = file_size;
+	return index_length;
+}
+
+int plm_demux_packet_is_intra(plm_packet_t *packet) {
+	for (size_t i = 0; i + 6 < packet->length; i++) {
+		// Find the START_PICTURE code
+		if (
+			packet->data[i] == 0x00 &&
+			packet->data[i + 1] == 0x00 &&
+			packet->data[i + 2] == 0x01 &&
+			packet->data[i + 3] == 0x00
+		) {
+			// Bits 11--13 in the picture header contain the frame 
+			// type, where 1=Intra
+			return (packet->data[i + 5] & 0x38) == 8;
+		}
+	}
+	return FALSE;
+}
+
+plm_packet_t *plm_demux_decode(plm_demux_t *self) {
+	if (!plm_demux_has_headers(self)) {
+		return NULL;
+	}
+
+	if (self->current_packet.length) {
+		size_t bits_till_next_packet = self->current_packet.length << 3;
+		if (!plm_buffer_has(self->buffer, bits_till_next_packet)) {
+			return NULL;
+		}
+		plm_buffer_skip(self->buffer, bits_till_next_packet);
+		plm_buffer_reclaim_read_bytes(self->buffer);
+		self->current_packet.length = 0;
+	}
+
+	// Pending packet waiting for data?
+	if (self->next_packet.length) {
+		return plm_demux_get_packet(self);
+	}
+
+	// Pending packet waiting for header?
+	if (self->start_code != -1) {
+		return plm_demux_decode_packet(self, self->start_code);
+	}
+
+	do {
+		self->start_code = plm_buffer_next_start_code(self->buffer);
+		if (
+			self->start_code == PLM_DEMUX_PACKET_VIDEO_1 || 
+			self->start_code == PLM_DEMUX_PACKET_PRIVATE || (
+				self->start_code >= PLM_DEMUX_PACKET_AUDIO_1 && 
+				self->start_code <= PLM_DEMUX_PACKET_AUDIO_4
+			)
+		) {
+			return plm_demux_decode_packet(self, self->start_code);
+		}
+	} while (self->start_code != -1);
+
+	return NULL;
+}
+
+double plm_demux_decode_time(plm_demux_t *self) {
+	int64_t clock = plm_buffer_read(self->buffer, 3) << 30;
+	plm_buffer_skip(self->buffer, 1);
+	clock |= plm_buffer_read(self->buffer, 15) << 15;
+	plm_buffer_skip(self->buffer, 1);
+	clock |= plm_buffer_read(self->buffer, 15);
+	plm_buffer_skip(self->buffer, 1);
+	return (double)clock / 90000.0;
+}
+
+plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type) {
+	if (!plm_buffer_has(self->buffer, 16 << 3)) {
+		return NULL;
 	}
 
 	self->start_code = -1;
@@ -2143,6 +3488,10 @@ static const int PLM_VIDEO_PICTURE_TYPE_INTRA = 1;
 static const int PLM_VIDEO_PICTURE_TYPE_PREDICTIVE = 2;
 static const int PLM_VIDEO_PICTURE_TYPE_B = 3;
 
+static const int PLM_VIDEO_MACROBLOCK_CHANGED = 0;
+static const int PLM_VIDEO_MACROBLOCK_FORWARD = 1;
+static const int PLM_VIDEO_MACROBLOCK_BACKWARD = 2;
+
 static const int PLM_START_SEQUENCE = 0xB3;
 static const int PLM_START_SLICE_FIRST = 0x01;
 static const int PLM_START_SLICE_LAST = 0xAF;
@@ -2544,6 +3893,37 @@ typedef struct {
 	int v;
 } plm_video_motion_t;
 
+// Inverse transforms the block, then writes it to (put) or adds it to (add)
+// the 8x8 pixels at dest with clamping, and clears the block. The variant
+// tells which part of the block may hold non-zero coefficients.
+
+enum plm_video_idct_variant {
+	PLM_VIDEO_IDCT_FIRST_ROW,
+	PLM_VIDEO_IDCT_FIRST_COLUMN,
+	PLM_VIDEO_IDCT_TOP_LEFT_4X4,
+	PLM_VIDEO_IDCT_FULL
+};
+
+typedef void(*plm_video_idct_store_t)(int *block, uint8_t *dest, int stride, int variant);
+
+// Predicts a block_size x block_size block at d from s with the given
+// interpolation case: (interpolate << 2) | (odd_h << 1) | odd_v.
+
+typedef void(*plm_video_motion_compensate_t)(uint8_t *s, uint8_t *d, int dw, int block_size, int mc_case);
+
+// Worker pool for slice-parallel decoding; see plm_video_set_thread_count().
+
+typedef struct plm_video_threads_t plm_video_threads_t;
+
+typedef struct {
+	plm_vlc_lookup_t macroblock_address_increment;
+	plm_vlc_lookup_t macroblock_type[4];
+	plm_vlc_lookup_t code_block_pattern;
+	plm_vlc_lookup_t motion;
+	plm_vlc_lookup_t dct_size[3];
+	plm_vlc_lookup_t dct_coeff;
+} plm_video_vlc_lookups_t;
+
 struct plm_video_t {
 	double framerate;
 	double time;
@@ -2589,14 +3969,86 @@ struct plm_video_t {
 
 	uint8_t *frames_data;
 
+	// Every macroblock row of a frame is tagged with the id of the picture it
+	// was last actually decoded in. Rows that were copied unchanged from a
+	// reference inherit its id, so two frames share a row exactly when the
+	// ids match. The row sources follow the three frames as they rotate.
+	uint8_t *macroblock_sources;
+	uint32_t *row_sources_data;
+	uint32_t *row_sources_current;
+	uint32_t *row_sources_forward;
+	uint32_t *row_sources_backward;
+	uint32_t *row_sources_shown;
+	uint32_t picture_id;
+	int has_shown_frame;
+	uint8_t *changed_rows;
+	int num_changed_rows;
+
 	int block_data[64];
 	uint8_t intra_quant_matrix[64];
 	uint8_t non_intra_quant_matrix[64];
 
+	// Only read while decoding, so the slice workers share them
+	plm_video_vlc_lookups_t *vlc;
+
 	int has_reference_frame;
 	int assume_no_b_frames;
+
+	int decode_depth;
+	int forward_skipped;
+	int backward_skipped;
+
+	plm_video_idct_store_t idct_put;
+	plm_video_idct_store_t idct_add;
+	plm_video_idct_stats_t idct_stats;
+
+	plm_video_motion_compensate_t motion_compensate;
+
+	int thread_count;
+	plm_video_threads_t *threads;
+};
+
+#ifdef PLM_THREADS
+
+// The slices of a picture are collected up front and then handed out to the
+// workers. Every worker decodes with its own copy of the decoder state and its
+// own view of the source buffer; they only share the frames and the VLC lookup
+// tables. Worker 0 is the calling thread.
+
+typedef struct {
+	int slice;
+	size_t bit_index;
+	int end_address;
+} plm_video_slice_t;
+
+typedef struct {
+	plm_video_threads_t *pool;
+	plm_video_t context;
+	plm_buffer_t buffer;
+	pthread_t thread;
+} plm_video_worker_t;
+
+struct plm_video_threads_t {
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	int generation;
+	int quit;
+	int busy;
+
+	plm_video_slice_t *slices;
+	int slices_capacity;
+	int num_slices;
+	int num_jobs;
+	int next_slice;
+	int slices_ordered;
+
+	plm_video_worker_t *workers;
+	int num_workers;
 };
 
+#endif
+
 static inline uint8_t plm_clamp(int n) {
 	if (n > 255) {
 		n = 255;
@@ -2608,18 +4060,28 @@ static inline uint8_t plm_clamp(int n) {
 }
 
 int plm_video_decode_sequence_header(plm_video_t *self);
+void plm_video_init_vlc_lookups(plm_video_t *self);
 void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base);
 void plm_video_decode_picture(plm_video_t *self);
+int plm_video_skip_picture(plm_video_t *self, int picture_type);
+void plm_video_advance_time(plm_video_t *self);
 void plm_video_decode_slice(plm_video_t *self, int slice);
+void plm_video_decode_slices_parallel(plm_video_t *self);
 void plm_video_decode_macroblock(plm_video_t *self);
+int plm_video_get_macroblock_source(plm_video_t *self);
+void plm_video_update_row_sources(plm_video_t *self);
+void plm_video_update_changed_rows(plm_video_t *self, plm_frame_t *frame);
 void plm_video_decode_motion_vectors(plm_video_t *self);
 int plm_video_decode_motion_vector(plm_video_t *self, int r_size, int motion);
 void plm_video_predict_macroblock(plm_video_t *self);
 void plm_video_copy_macroblock(plm_video_t *self, plm_frame_t *s, int motion_h, int motion_v);
 void plm_video_interpolate_macroblock(plm_video_t *self, plm_frame_t *s, int motion_h, int motion_v);
 void plm_video_process_macroblock(plm_video_t *self, uint8_t *s, uint8_t *d, int mh, int mb, int bs, int interp);
+void plm_video_motion_compensate_scalar(uint8_t *s, uint8_t *d, int dw, int block_size, int mc_case);
+void plm_video_init_motion_compensate(plm_video_t *self);
 void plm_video_decode_block(plm_video_t *self, int block);
 void plm_video_idct(int *block);
+void plm_video_init_idct(plm_video_t *self);
 
 plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
 	plm_video_t *self = (plm_video_t *)malloc(sizeof(plm_video_t));
@@ -2627,6 +4089,11 @@ plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_whe
 	
 	self->buffer = buffer;
 	self->destroy_buffer_when_done = destroy_when_done;
+	self->thread_count = 1;
+
+	plm_video_init_vlc_lookups(self);
+	plm_video_init_idct(self);
+	plm_video_init_motion_compensate(self);
 
 	// Attempt to decode the sequence header
 	self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_SEQUENCE);
@@ -2636,15 +4103,37 @@ plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_whe
 	return self;
 }
 
+void plm_video_init_vlc_lookups(plm_video_t *self) {
+	plm_video_vlc_lookups_t *vlc = (plm_video_vlc_lookups_t *)malloc(sizeof(plm_video_vlc_lookups_t));
+	memset(vlc, 0, sizeof(plm_video_vlc_lookups_t));
+
+	plm_vlc_lookup_init(&vlc->macroblock_address_increment, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+	for (int i = 1; i < 4; i++) {
+		plm_vlc_lookup_init(&vlc->macroblock_type[i], PLM_VIDEO_MACROBLOCK_TYPE[i]);
+	}
+	plm_vlc_lookup_init(&vlc->code_block_pattern, PLM_VIDEO_CODE_BLOCK_PATTERN);
+	plm_vlc_lookup_init(&vlc->motion, PLM_VIDEO_MOTION);
+	for (int i = 0; i < 3; i++) {
+		plm_vlc_lookup_init(&vlc->dct_size[i], PLM_VIDEO_DCT_SIZE[i]);
+	}
+	plm_vlc_lookup_init(&vlc->dct_coeff, (const plm_vlc_t *)PLM_VIDEO_DCT_COEFF);
+	self->vlc = vlc;
+}
+
 void plm_video_destroy(plm_video_t *self) {
+	plm_video_set_thread_count(self, 1);
+
 	if (self->destroy_buffer_when_done) {
 		plm_buffer_destroy(self->buffer);
 	}
 
 	if (self->has_sequence_header) {
 		free(self->frames_data);
+		free(self->macroblock_sources);
+		free(self->row_sources_data);
 	}
 
+	free(self->vlc);
 	free(self);
 }
 
@@ -2670,6 +4159,228 @@ void plm_video_set_no_delay(plm_video_t *self, int no_delay) {
 	self->assume_no_b_frames = no_delay;
 }
 
+int plm_video_get_thread_count(plm_video_t *self) {
+	return self->thread_count;
+}
+
+#ifdef PLM_THREADS
+
+void *plm_video_thread_main(void *user);
+void plm_video_worker_decode_slices(plm_video_worker_t *worker);
+void plm_video_worker_decode_slice(plm_video_worker_t *worker, int index);
+
+void plm_video_set_thread_count(plm_video_t *self, int thread_count) {
+	if (thread_count < 1) {
+		thread_count = 1;
+	}
+	if (thread_count == self->thread_count) {
+		return;
+	}
+
+	// Join and free the current pool
+	plm_video_threads_t *pool = self->threads;
+	if (pool) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->quit = TRUE;
+		pthread_cond_broadcast(&pool->job_cond);
+		pthread_mutex_unlock(&pool->mutex);
+
+		for (int i = 1; i < pool->num_workers; i++) {
+			pthread_join(pool->workers[i].thread, NULL);
+		}
+
+		pthread_cond_destroy(&pool->done_cond);
+		pthread_cond_destroy(&pool->job_cond);
+		pthread_mutex_destroy(&pool->mutex);
+		free(pool->workers);
+		free(pool->slices);
+		free(pool);
+		self->threads = NULL;
+	}
+	self->thread_count = 1;
+
+	if (thread_count == 1) {
+		return;
+	}
+
+	pool = (plm_video_threads_t *)malloc(sizeof(plm_video_threads_t));
+	memset(pool, 0, sizeof(plm_video_threads_t));
+	pool->workers = (plm_video_worker_t *)malloc(sizeof(plm_video_worker_t) * thread_count);
+	memset(pool->workers, 0, sizeof(plm_video_worker_t) * thread_count);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	pool->workers[0].pool = pool;
+	pool->num_workers = 1;
+	for (int i = 1; i < thread_count; i++) {
+		plm_video_worker_t *worker = &pool->workers[i];
+		worker->pool = pool;
+		if (pthread_create(&worker->thread, NULL, plm_video_thread_main, worker) != 0) {
+			break;
+		}
+		pool->num_workers++;
+	}
+
+	self->threads = pool;
+	self->thread_count = pool->num_workers;
+}
+
+void *plm_video_thread_main(void *user) {
+	plm_video_worker_t *worker = (plm_video_worker_t *)user;
+	plm_video_threads_t *pool = worker->pool;
+
+	// Workers are started with a fresh pool; a job may already have been
+	// posted by the time this thread runs.
+	int generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (TRUE) {
+		while (!pool->quit && pool->generation == generation) {
+			pthread_cond_wait(&pool->job_cond, &pool->mutex);
+		}
+		if (pool->quit) {
+			break;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		plm_video_worker_decode_slices(worker);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->busy--;
+		if (pool->busy == 0) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+void plm_video_worker_decode_slices(plm_video_worker_t *worker) {
+	plm_video_threads_t *pool = worker->pool;
+
+	while (TRUE) {
+		pthread_mutex_lock(&pool->mutex);
+		int index = pool->next_slice;
+		if (index < pool->num_jobs) {
+			pool->next_slice++;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (index >= pool->num_jobs) {
+			return;
+		}
+		plm_video_worker_decode_slice(worker, index);
+	}
+}
+
+void plm_video_worker_decode_slice(plm_video_worker_t *worker, int index) {
+	plm_video_slice_t *slice = &worker->pool->slices[index];
+	worker->buffer.bit_index = slice->bit_index;
+	plm_video_decode_slice(&worker->context, slice->slice);
+	slice->end_address = worker->context.macroblock_address;
+}
+
+void plm_video_decode_slices_parallel(plm_video_t *self) {
+	plm_video_threads_t *pool = self->threads;
+
+	// Collect the positions of all slices. Read bytes must not be discarded
+	// while doing so, as that would move the data of the earlier slices.
+	int previous_discard_read_bytes = self->buffer->discard_read_bytes;
+	self->buffer->discard_read_bytes = FALSE;
+
+	pool->num_slices = 0;
+	pool->slices_ordered = TRUE;
+	while (PLM_START_IS_SLICE(self->start_code)) {
+		if (pool->num_slices == pool->slices_capacity) {
+			pool->slices_capacity = pool->slices_capacity ? pool->slices_capacity * 2 : 64;
+			pool->slices = (plm_video_slice_t *)realloc(
+				pool->slices, sizeof(plm_video_slice_t) * pool->slices_capacity
+			);
+		}
+
+		plm_video_slice_t *slice = &pool->slices[pool->num_slices++];
+		slice->slice = self->start_code & 0x000000FF;
+		slice->bit_index = self->buffer->bit_index;
+		if (pool->num_slices > 1 && slice->slice < slice[-1].slice) {
+			pool->slices_ordered = FALSE;
+		}
+
+		self->start_code = plm_buffer_next_start_code(self->buffer);
+	}
+	self->buffer->discard_read_bytes = previous_discard_read_bytes;
+
+	for (int i = 0; i < pool->num_workers; i++) {
+		plm_video_worker_t *worker = &pool->workers[i];
+		memcpy(&worker->context, self, sizeof(plm_video_t));
+		memset(&worker->context.idct_stats, 0, sizeof(plm_video_idct_stats_t));
+
+		// Fixed memory view of the source buffer, which holds the whole picture
+		worker->buffer = *self->buffer;
+		worker->buffer.mode = PLM_BUFFER_MODE_FIXED_MEM;
+		worker->buffer.discard_read_bytes = FALSE;
+		worker->buffer.total_size = worker->buffer.length;
+		worker->buffer.load_callback = NULL;
+		worker->buffer.fh = NULL;
+		worker->buffer.mapped_length = 0;
+		worker->context.buffer = &worker->buffer;
+	}
+
+	// Hand out all but the last slice. Serial decoding stops once a slice
+	// reaches the second to last macroblock, which may leave out the last
+	// slice; so it is decoded afterwards under the same rule. Slices that are
+	// out of order (broken streams) may overlap and are all decoded serially.
+	pool->next_slice = 0;
+	pool->num_jobs = (pool->slices_ordered && pool->num_slices > 2)
+		? pool->num_slices - 1
+		: 0;
+	if (pool->num_jobs) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->busy = pool->num_workers - 1;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->job_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	plm_video_worker_decode_slices(&pool->workers[0]);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->busy > 0) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (int i = pool->num_jobs; i < pool->num_slices; i++) {
+		if (i > 0 && pool->slices[i - 1].end_address >= self->mb_size - 2) {
+			break;
+		}
+		plm_video_worker_decode_slice(&pool->workers[0], i);
+	}
+
+	for (int i = 0; i < pool->num_workers; i++) {
+		plm_video_idct_stats_t *stats = &pool->workers[i].context.idct_stats;
+		self->idct_stats.dc_only += stats->dc_only;
+		self->idct_stats.first_row += stats->first_row;
+		self->idct_stats.first_column += stats->first_column;
+		self->idct_stats.top_left_4x4 += stats->top_left_4x4;
+		self->idct_stats.full += stats->full;
+	}
+}
+
+#else
+
+void plm_video_set_thread_count(plm_video_t *self, int thread_count) {
+	PLM_UNUSED(thread_count);
+	self->thread_count = 1;
+}
+
+void plm_video_decode_slices_parallel(plm_video_t *self) {
+	PLM_UNUSED(self);
+}
+
+#endif // PLM_THREADS
+
 double plm_video_get_time(plm_video_t *self) {
 	return self->time;
 }
@@ -2684,6 +4395,9 @@ void plm_video_rewind(plm_video_t *self) {
 	self->time = 0;
 	self->frames_decoded = 0;
 	self->has_reference_frame = FALSE;
+	self->has_shown_frame = FALSE;
+	self->forward_skipped = FALSE;
+	self->backward_skipped = FALSE;
 	self->start_code = -1;
 }
 
@@ -2691,6 +4405,21 @@ int plm_video_has_ended(plm_video_t *self) {
 	return plm_buffer_has_ended(self->buffer);
 }
 
+plm_video_idct_stats_t plm_video_get_idct_stats(plm_video_t *self) {
+	return self->idct_stats;
+}
+
+int plm_video_get_changed_rows(plm_video_t *self, uint8_t *rows) {
+	if (!self->has_sequence_header) {
+		return 0;
+	}
+
+	if (rows) {
+		memcpy(rows, self->changed_rows, self->mb_height);
+	}
+	return self->num_changed_rows;
+}
+
 plm_frame_t *plm_video_decode(plm_video_t *self) {
 	if (!plm_video_has_header(self)) {
 		return NULL;
@@ -2706,6 +4435,7 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 				// frame was a reference frame, we still have to return it.
 				if (
 					self->has_reference_frame &&
+					!self->backward_skipped &&
 					!self->assume_no_b_frames &&
 					plm_buffer_has_ended(self->buffer) && (
 						self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
@@ -2732,16 +4462,59 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 		) {
 			return NULL;
 		}
-		plm_buffer_discard_read_bytes(self->buffer);
-		
+		plm_buffer_release_read_bytes(self->buffer);
+
+		// Peek at the picture type following the temporal reference
+		size_t picture_start = self->buffer->bit_index;
+		plm_buffer_skip(self->buffer, 10);
+		int picture_type = plm_buffer_read(self->buffer, 3);
+		self->buffer->bit_index = picture_start;
+
+		// Skipped pictures are left in the buffer to be stepped over by the
+		// search for the next picture start code. They still take their place
+		// in the presentation order, which for a reference picture means the
+		// one before it is presented now, unless that was skipped as well.
+		if (plm_video_skip_picture(self, picture_type)) {
+			self->picture_type = picture_type;
+			self->start_code = -1;
+
+			if (picture_type == PLM_VIDEO_PICTURE_TYPE_B || self->assume_no_b_frames) {
+				plm_video_advance_time(self);
+				continue;
+			}
+
+			if (self->has_reference_frame && !self->backward_skipped) {
+				frame = &self->frame_backward;
+			}
+			else if (self->has_reference_frame) {
+				plm_video_advance_time(self);
+			}
+			self->has_reference_frame = TRUE;
+			self->forward_skipped = self->backward_skipped;
+			self->backward_skipped = TRUE;
+			continue;
+		}
+
 		plm_video_decode_picture(self);
 
+		int is_reference = (
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE
+		);
+		if (is_reference) {
+			self->forward_skipped = self->backward_skipped;
+			self->backward_skipped = FALSE;
+		}
+
 		if (self->assume_no_b_frames) {
 			frame = &self->frame_backward;
 		}
 		else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
 			frame = &self->frame_current;
 		}
+		else if (is_reference && self->forward_skipped) {
+			plm_video_advance_time(self);
+		}
 		else if (self->has_reference_frame) {
 			frame = &self->frame_forward;
 		}
@@ -2750,17 +4523,48 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 		}
 	} while (!frame);
 	
+	plm_video_update_changed_rows(self, frame);
+
 	frame->time = self->time;
-	self->frames_decoded++;
-	self->time = (double)self->frames_decoded / self->framerate;
+	plm_video_advance_time(self);
 	
 	return frame;
 }
 
-int plm_video_has_header(plm_video_t *self) {
-	if (self->has_sequence_header) {
-		return TRUE;
-	}
+int plm_video_get_decode_depth(plm_video_t *self) {
+	return self->decode_depth;
+}
+
+void plm_video_set_decode_depth(plm_video_t *self, int depth) {
+	self->decode_depth = depth;
+}
+
+int plm_video_skip_picture(plm_video_t *self, int picture_type) {
+	if (picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+		return (
+			self->decode_depth >= PLM_VIDEO_DECODE_DEPTH_INTRA ||
+			self->backward_skipped
+		);
+	}
+	if (picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
+		return (
+			self->decode_depth >= PLM_VIDEO_DECODE_DEPTH_SKIP_B ||
+			self->forward_skipped ||
+			self->backward_skipped
+		);
+	}
+	return FALSE;
+}
+
+void plm_video_advance_time(plm_video_t *self) {
+	self->frames_decoded++;
+	self->time = (double)self->frames_decoded / self->framerate;
+}
+
+int plm_video_has_header(plm_video_t *self) {
+	if (self->has_sequence_header) {
+		return TRUE;
+	}
 
 	if (self->start_code != PLM_START_SEQUENCE) {
 		self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_SEQUENCE);
@@ -2840,6 +4644,15 @@ int plm_video_decode_sequence_header(plm_video_t *self) {
 	plm_video_init_frame(self, &self->frame_forward, self->frames_data + frame_data_size * 1);
 	plm_video_init_frame(self, &self->frame_backward, self->frames_data + frame_data_size * 2);
 
+	self->macroblock_sources = (uint8_t*)malloc(self->mb_size + self->mb_height);
+	self->changed_rows = self->macroblock_sources + self->mb_size;
+
+	self->row_sources_data = (uint32_t*)calloc(self->mb_height * 4, sizeof(uint32_t));
+	self->row_sources_current = self->row_sources_data;
+	self->row_sources_forward = self->row_sources_data + self->mb_height;
+	self->row_sources_backward = self->row_sources_data + self->mb_height * 2;
+	self->row_sources_shown = self->row_sources_data + self->mb_height * 3;
+
 	self->has_sequence_header = TRUE;
 	return TRUE;
 }
@@ -2899,13 +4712,17 @@ void plm_video_decode_picture(plm_video_t *self) {
 	}
 
 	plm_frame_t frame_temp = self->frame_forward;
+	uint32_t *row_sources_temp = self->row_sources_forward;
 	if (
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE
 	) {
 		self->frame_forward = self->frame_backward;
+		self->row_sources_forward = self->row_sources_backward;
 	}
 
+	memset(self->macroblock_sources, PLM_VIDEO_MACROBLOCK_CHANGED, self->mb_size);
+
 
 	// Find first slice start code; skip extension and user data
 	do {
@@ -2916,6 +4733,9 @@ void plm_video_decode_picture(plm_video_t *self) {
 	);
 
 	// Decode all slices
+	if (self->thread_count > 1) {
+		plm_video_decode_slices_parallel(self);
+	}
 	while (PLM_START_IS_SLICE(self->start_code)) {
 		plm_video_decode_slice(self, self->start_code & 0x000000FF);
 		if (self->macroblock_address >= self->mb_size - 2) {
@@ -2924,6 +4744,8 @@ void plm_video_decode_picture(plm_video_t *self) {
 		self->start_code = plm_buffer_next_start_code(self->buffer);
 	}
 
+	plm_video_update_row_sources(self);
+
 	// If this is a reference picture rotate the prediction pointers
 	if (
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
@@ -2931,9 +4753,55 @@ void plm_video_decode_picture(plm_video_t *self) {
 	) {
 		self->frame_backward = self->frame_current;
 		self->frame_current = frame_temp;
+		self->row_sources_backward = self->row_sources_current;
+		self->row_sources_current = row_sources_temp;
 	}
 }
 
+void plm_video_update_row_sources(plm_video_t *self) {
+	self->picture_id++;
+
+	for (int row = 0; row < self->mb_height; row++) {
+		uint8_t *sources = self->macroblock_sources + row * self->mb_width;
+		int source = sources[0];
+		for (int col = 1; col < self->mb_width && source; col++) {
+			if (sources[col] != source) {
+				source = PLM_VIDEO_MACROBLOCK_CHANGED;
+			}
+		}
+
+		if (source == PLM_VIDEO_MACROBLOCK_FORWARD) {
+			self->row_sources_current[row] = self->row_sources_forward[row];
+		}
+		else if (source == PLM_VIDEO_MACROBLOCK_BACKWARD) {
+			self->row_sources_current[row] = self->row_sources_backward[row];
+		}
+		else {
+			self->row_sources_current[row] = self->picture_id;
+		}
+	}
+}
+
+void plm_video_update_changed_rows(plm_video_t *self, plm_frame_t *frame) {
+	uint32_t *sources = self->row_sources_backward;
+	if (frame == &self->frame_current) {
+		sources = self->row_sources_current;
+	}
+	else if (frame == &self->frame_forward) {
+		sources = self->row_sources_forward;
+	}
+
+	self->num_changed_rows = 0;
+	for (int row = 0; row < self->mb_height; row++) {
+		int changed = !self->has_shown_frame || sources[row] != self->row_sources_shown[row];
+		self->changed_rows[row] = changed;
+		self->num_changed_rows += changed;
+	}
+
+	memcpy(self->row_sources_shown, sources, self->mb_height * sizeof(uint32_t));
+	self->has_shown_frame = TRUE;
+}
+
 void plm_video_decode_slice(plm_video_t *self, int slice) {
 	self->slice_begin = TRUE;
 	self->macroblock_address = (slice - 1) * self->mb_width - 1;
@@ -2963,16 +4831,16 @@ void plm_video_decode_slice(plm_video_t *self, int slice) {
 void plm_video_decode_macroblock(plm_video_t *self) {
 	// Decode increment
 	int increment = 0;
-	int t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+	int t = plm_buffer_read_vlc_lookup(self->buffer, &self->vlc->macroblock_address_increment);
 
 	while (t == 34) {
 		// macroblock_stuffing
-		t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+		t = plm_buffer_read_vlc_lookup(self->buffer, &self->vlc->macroblock_address_increment);
 	}
 	while (t == 35) {
 		// macroblock_escape
 		increment += 33;
-		t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+		t = plm_buffer_read_vlc_lookup(self->buffer, &self->vlc->macroblock_address_increment);
 	}
 	increment += t;
 
@@ -3007,6 +4875,7 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 			self->mb_col = self->macroblock_address % self->mb_width;
 
 			plm_video_predict_macroblock(self);
+			self->macroblock_sources[self->macroblock_address] = plm_video_get_macroblock_source(self);
 			increment--;
 		}
 		self->macroblock_address++;
@@ -3020,8 +4889,8 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 	}
 
 	// Process the current macroblock
-	const plm_vlc_t *table = PLM_VIDEO_MACROBLOCK_TYPE[self->picture_type];
-	self->macroblock_type = plm_buffer_read_vlc(self->buffer, table);
+	const plm_vlc_lookup_t *table = &self->vlc->macroblock_type[self->picture_type];
+	self->macroblock_type = plm_buffer_read_vlc_lookup(self->buffer, table);
 
 	self->macroblock_intra = (self->macroblock_type & 0x01);
 	self->motion_forward.is_set = (self->macroblock_type & 0x08);
@@ -3049,7 +4918,7 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 
 	// Decode blocks
 	int cbp = ((self->macroblock_type & 0x02) != 0)
-		? plm_buffer_read_vlc(self->buffer, PLM_VIDEO_CODE_BLOCK_PATTERN)
+		? plm_buffer_read_vlc_lookup(self->buffer, &self->vlc->code_block_pattern)
 		: (self->macroblock_intra ? 0x3f : 0);
 
 	for (int block = 0, mask = 0x20; block < 6; block++) {
@@ -3058,6 +4927,35 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 		}
 		mask >>= 1;
 	}
+
+	if (self->macroblock_address >= 0) {
+		self->macroblock_sources[self->macroblock_address] = (self->macroblock_intra || cbp)
+			? PLM_VIDEO_MACROBLOCK_CHANGED
+			: plm_video_get_macroblock_source(self);
+	}
+}
+
+int plm_video_get_macroblock_source(plm_video_t *self) {
+	// A predicted macroblock without residual is an exact copy of its
+	// reference only if it has no motion and a single reference.
+	plm_video_motion_t *forward = &self->motion_forward;
+	plm_video_motion_t *backward = &self->motion_backward;
+
+	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+		return (forward->h == 0 && forward->v == 0)
+			? PLM_VIDEO_MACROBLOCK_FORWARD
+			: PLM_VIDEO_MACROBLOCK_CHANGED;
+	}
+
+	if (forward->is_set) {
+		return (!backward->is_set && forward->h == 0 && forward->v == 0)
+			? PLM_VIDEO_MACROBLOCK_FORWARD
+			: PLM_VIDEO_MACROBLOCK_CHANGED;
+	}
+
+	return (backward->h == 0 && backward->v == 0)
+		? PLM_VIDEO_MACROBLOCK_BACKWARD
+		: PLM_VIDEO_MACROBLOCK_CHANGED;
 }
 
 void plm_video_decode_motion_vectors(plm_video_t *self) {
@@ -3083,7 +4981,7 @@ void plm_video_decode_motion_vectors(plm_video_t *self) {
 
 int plm_video_decode_motion_vector(plm_video_t *self, int r_size, int motion) {
 	int fscale = 1 << r_size;
-	int m_code = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MOTION);
+	int m_code = plm_buffer_read_vlc_lookup(self->buffer, &self->vlc->motion);
 	int r = 0;
 	int d;
 
@@ -3187,12 +5085,20 @@ void plm_video_process_macroblock(
 		return; // corrupt video
 	}
 
+	int mc_case = (interpolate << 2) | (odd_h << 1) | (odd_v);
+	self->motion_compensate(s + si, d + di, dw, block_size, mc_case);
+}
+
+void plm_video_motion_compensate_scalar(uint8_t *s, uint8_t *d, int dw, int block_size, int mc_case) {
+	int si = 0;
+	int di = 0;
+
 	#define PLM_MB_CASE(INTERPOLATE, ODD_H, ODD_V, OP) \
 		case ((INTERPOLATE << 2) | (ODD_H << 1) | (ODD_V)): \
 			PLM_BLOCK_SET(d, di, dw, si, dw, block_size, OP); \
 			break
 
-	switch ((interpolate << 2) | (odd_h << 1) | (odd_v)) {
+	switch (mc_case) {
 		PLM_MB_CASE(0, 0, 0, (s[si]));
 		PLM_MB_CASE(0, 0, 1, (s[si] + s[si + dw] + 1) >> 1);
 		PLM_MB_CASE(0, 1, 0, (s[si] + s[si + 1] + 1) >> 1);
@@ -3207,9 +5113,123 @@ void plm_video_process_macroblock(
 	#undef PLM_MB_CASE
 }
 
+// The SIMD versions compute the same rounding averages as the PLM_MB_CASE
+// expressions above: pavgb for (a + b + 1) >> 1 and a 16 bit sum for the
+// four point average, which can not be composed from two pavgb exactly.
+// Each row reads the same bytes as the scalar code.
+
+#define PLM_MC_CASES(T, LOAD, STORE, AVG, AVG4) \
+	switch (mc_case) { \
+		case 0: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, LOAD(s)); } break; \
+		case 1: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, AVG(LOAD(s), LOAD(s + dw))); } break; \
+		case 2: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, AVG(LOAD(s), LOAD(s + 1))); } break; \
+		case 3: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, AVG4(LOAD(s), LOAD(s + 1), LOAD(s + dw), LOAD(s + dw + 1))); } break; \
+		case 4: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, AVG(LOAD(d), LOAD(s))); } break; \
+		case 5: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, AVG(LOAD(d), AVG(LOAD(s), LOAD(s + dw)))); } break; \
+		case 6: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, AVG(LOAD(d), AVG(LOAD(s), LOAD(s + 1)))); } break; \
+		case 7: for (int y = 0; y < block_size; y++, s += dw, d += dw) { \
+			STORE(d, AVG(LOAD(d), AVG4(LOAD(s), LOAD(s + 1), LOAD(s + dw), LOAD(s + dw + 1)))); } break; \
+	}
+
+#ifdef PLM_SIMD_X86
+
+PLM_SIMD_TARGET("sse2")
+static inline __m128i plm_sse2_avg4_epu8(__m128i a, __m128i b, __m128i c, __m128i d) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i two = _mm_set1_epi16(2);
+	__m128i lo = _mm_add_epi16(
+		_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+		_mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero))
+	);
+	__m128i hi = _mm_add_epi16(
+		_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+		_mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero))
+	);
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+	return _mm_packus_epi16(lo, hi);
+}
+
+#define PLM_SSE2_LOAD_16(P) _mm_loadu_si128((const __m128i *)(P))
+#define PLM_SSE2_STORE_16(P, V) _mm_storeu_si128((__m128i *)(P), V)
+#define PLM_SSE2_LOAD_8(P) _mm_loadl_epi64((const __m128i *)(P))
+#define PLM_SSE2_STORE_8(P, V) _mm_storel_epi64((__m128i *)(P), V)
+
+PLM_SIMD_TARGET("sse2")
+void plm_video_motion_compensate_sse2(uint8_t *s, uint8_t *d, int dw, int block_size, int mc_case) {
+	if (block_size == 16) {
+		PLM_MC_CASES(__m128i, PLM_SSE2_LOAD_16, PLM_SSE2_STORE_16, _mm_avg_epu8, plm_sse2_avg4_epu8);
+	}
+	else if (block_size == 8) {
+		PLM_MC_CASES(__m128i, PLM_SSE2_LOAD_8, PLM_SSE2_STORE_8, _mm_avg_epu8, plm_sse2_avg4_epu8);
+	}
+	else {
+		plm_video_motion_compensate_scalar(s, d, dw, block_size, mc_case);
+	}
+}
+
+#undef PLM_SSE2_LOAD_16
+#undef PLM_SSE2_STORE_16
+#undef PLM_SSE2_LOAD_8
+#undef PLM_SSE2_STORE_8
+
+#endif // PLM_SIMD_X86
+
+#ifdef PLM_SIMD_NEON
+
+static inline uint8x8_t plm_neon_avg4_u8(uint8x8_t a, uint8x8_t b, uint8x8_t c, uint8x8_t d) {
+	return vrshrn_n_u16(vaddq_u16(vaddl_u8(a, b), vaddl_u8(c, d)), 2);
+}
+
+// Works on 8 pixel wide columns, so that luma and chroma share one path
+
+void plm_video_motion_compensate_neon(uint8_t *s, uint8_t *d, int dw, int block_size, int mc_case) {
+	if (block_size % 8 != 0) {
+		plm_video_motion_compensate_scalar(s, d, dw, block_size, mc_case);
+		return;
+	}
+	uint8_t *s_base = s;
+	uint8_t *d_base = d;
+	for (int x = 0; x < block_size; x += 8) {
+		s = s_base + x;
+		d = d_base + x;
+		PLM_MC_CASES(uint8x8_t, vld1_u8, vst1_u8, vrhadd_u8, plm_neon_avg4_u8);
+	}
+}
+
+#endif // PLM_SIMD_NEON
+
+#undef PLM_MC_CASES
+
+void plm_video_init_motion_compensate(plm_video_t *self) {
+	int features = plm_cpu_features();
+	PLM_UNUSED(features);
+
+	self->motion_compensate = plm_video_motion_compensate_scalar;
+
+	#if defined(PLM_SIMD_X86)
+		if (features & PLM_CPU_SSE2) {
+			self->motion_compensate = plm_video_motion_compensate_sse2;
+		}
+	#elif defined(PLM_SIMD_NEON)
+		if (features & PLM_CPU_NEON) {
+			self->motion_compensate = plm_video_motion_compensate_neon;
+		}
+	#endif
+}
+
 void plm_video_decode_block(plm_video_t *self, int block) {
 
 	int n = 0;
+	int rows = 0; // Bitmask of rows with non-zero coefficients
+	int cols = 0; // Bitmask of columns with non-zero coefficients
 	uint8_t *quant_matrix;
 
 	// Decode DC coefficient of intra-coded blocks
@@ -3220,7 +5240,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 		// DC prediction
 		int plane_index = block > 3 ? block - 3 : 0;
 		predictor = self->dc_predictor[plane_index];
-		dct_size = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_DCT_SIZE[plane_index]);
+		dct_size = plm_buffer_read_vlc_lookup(self->buffer, &self->vlc->dct_size[plane_index]);
 
 		// Read DC coeff
 		if (dct_size > 0) {
@@ -3244,6 +5264,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 
 		quant_matrix = self->intra_quant_matrix;
 		n = 1;
+		rows = cols = 1;
 	}
 	else {
 		quant_matrix = self->non_intra_quant_matrix;
@@ -3253,7 +5274,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 	int level = 0;
 	while (TRUE) {
 		int run = 0;
-		uint16_t coeff = plm_buffer_read_vlc_uint(self->buffer, PLM_VIDEO_DCT_COEFF);
+		uint16_t coeff = plm_buffer_read_vlc_lookup_uint(self->buffer, &self->vlc->dct_coeff);
 
 		if ((coeff == 0x0001) && (n > 0) && (plm_buffer_read(self->buffer, 1) == 0)) {
 			// end_of_block
@@ -3283,6 +5304,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 
 		n += run;
 		if (n < 0 || n >= 64) {
+			memset(self->block_data, 0, sizeof(self->block_data));
 			return; // invalid
 		}
 
@@ -3307,6 +5329,8 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 
 		// Save premultiplied coefficient
 		self->block_data[de_zig_zagged] = level * PLM_VIDEO_PREMULTIPLIER_MATRIX[de_zig_zagged];
+		rows |= 1 << (de_zig_zagged >> 3);
+		cols |= 1 << (de_zig_zagged & 7);
 	}
 
 	// Move block to its place
@@ -3331,6 +5355,27 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 		di = ((self->mb_row * self->luma_width) << 2) + (self->mb_col << 3);
 	}
 
+	// Pick the cheapest transform that covers all non-zero coefficients
+	int variant = PLM_VIDEO_IDCT_FULL;
+	if (n == 1) {
+		self->idct_stats.dc_only++;
+	}
+	else if (rows == 1) {
+		variant = PLM_VIDEO_IDCT_FIRST_ROW;
+		self->idct_stats.first_row++;
+	}
+	else if (cols == 1) {
+		variant = PLM_VIDEO_IDCT_FIRST_COLUMN;
+		self->idct_stats.first_column++;
+	}
+	else if (((rows | cols) & 0xf0) == 0) {
+		variant = PLM_VIDEO_IDCT_TOP_LEFT_4X4;
+		self->idct_stats.top_left_4x4++;
+	}
+	else {
+		self->idct_stats.full++;
+	}
+
 	int *s = self->block_data;
 	int si = 0;
 	if (self->macroblock_intra) {
@@ -3341,9 +5386,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 			s[0] = 0;
 		}
 		else {
-			plm_video_idct(s);
-			PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(s[si]));
-			memset(self->block_data, 0, sizeof(self->block_data));
+			self->idct_put(s, d + di, dw, variant);
 		}
 	}
 	else {
@@ -3354,9 +5397,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 			s[0] = 0;
 		}
 		else {
-			plm_video_idct(s);
-			PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + s[si]));
-			memset(self->block_data, 0, sizeof(self->block_data));
+			self->idct_add(s, d + di, dw, variant);
 		}
 	}
 }
@@ -3427,17 +5468,549 @@ void plm_video_idct(int *block) {
 	}
 }
 
+// The 1D transform of plm_video_idct() on 8 values of any type. OUT applies
+// the final rounding of the second pass, or nothing for the first pass. Used
+// by the reduced and the SIMD transforms below, which produce the exact same
+// results as plm_video_idct().
+
+#define PLM_IDCT_1D(T, ADD, SUB, MUL, RND, NEG, OUT, s0, s1, s2, s3, s4, s5, s6, s7) do { \
+	T b1 = s4; \
+	T b3 = ADD(s2, s6); \
+	T b4 = SUB(s5, s3); \
+	T tmp1 = ADD(s1, s7); \
+	T tmp2 = ADD(s3, s5); \
+	T b6 = SUB(s1, s7); \
+	T b7 = ADD(tmp1, tmp2); \
+	T m0 = s0; \
+	T x4 = SUB(RND(SUB(MUL(b6, 473), MUL(b4, 196))), b7); \
+	T x0 = SUB(x4, RND(MUL(SUB(tmp1, tmp2), 362))); \
+	T x1 = SUB(m0, b1); \
+	T x2 = SUB(RND(MUL(SUB(s2, s6), 362)), b3); \
+	T x3 = ADD(m0, b1); \
+	T y3 = ADD(x1, x2); \
+	T y4 = ADD(x3, b3); \
+	T y5 = SUB(x1, x2); \
+	T y6 = SUB(x3, b3); \
+	T y7 = NEG(ADD(x0, RND(ADD(MUL(b4, 473), MUL(b6, 196))))); \
+	s0 = OUT(ADD(b7, y4)); \
+	s1 = OUT(ADD(x4, y3)); \
+	s2 = OUT(SUB(y5, x0)); \
+	s3 = OUT(SUB(y6, y7)); \
+	s4 = OUT(ADD(y6, y7)); \
+	s5 = OUT(ADD(x0, y5)); \
+	s6 = OUT(SUB(y3, x4)); \
+	s7 = OUT(SUB(y4, b7)); \
+	} while(FALSE)
+
+#define PLM_IDCT_PASS(X) (X)
+
+#define PLM_IDCT_ADD(A, B) ((A) + (B))
+#define PLM_IDCT_SUB(A, B) ((A) - (B))
+#define PLM_IDCT_MUL(A, C) ((A) * (C))
+#define PLM_IDCT_RND(A) (((A) + 128) >> 8)
+#define PLM_IDCT_NEG(A) (-(A))
+
+// Reduced transforms for blocks whose non-zero coefficients are all in the
+// first row, the first column or the top-left 4x4 of the block.
+// With only the first row set, the column pass copies it to every row, so
+// the row pass result of the first row is the result for all rows. With
+// only the first column set, every row's result is the rounded column pass
+// result in all columns. Both leave their results in the first row/column.
+
+void plm_video_idct_first_row(int *block) {
+	PLM_IDCT_1D(int, PLM_IDCT_ADD, PLM_IDCT_SUB, PLM_IDCT_MUL, PLM_IDCT_RND, PLM_IDCT_NEG, PLM_IDCT_RND,
+		block[0], block[1], block[2], block[3], block[4], block[5], block[6], block[7]);
+}
+
+void plm_video_idct_first_column(int *block) {
+	PLM_IDCT_1D(int, PLM_IDCT_ADD, PLM_IDCT_SUB, PLM_IDCT_MUL, PLM_IDCT_RND, PLM_IDCT_NEG, PLM_IDCT_RND,
+		block[0], block[8], block[16], block[24], block[32], block[40], block[48], block[56]);
+}
+
+void plm_video_idct_top_left_4x4(int *block) {
+	for (int i = 0; i < 4; i++) {
+		PLM_IDCT_1D(int, PLM_IDCT_ADD, PLM_IDCT_SUB, PLM_IDCT_MUL, PLM_IDCT_RND, PLM_IDCT_NEG, PLM_IDCT_PASS,
+			block[i], block[8 + i], block[16 + i], block[24 + i],
+			block[32 + i], block[40 + i], block[48 + i], block[56 + i]);
+	}
+	for (int i = 0; i < 64; i += 8) {
+		PLM_IDCT_1D(int, PLM_IDCT_ADD, PLM_IDCT_SUB, PLM_IDCT_MUL, PLM_IDCT_RND, PLM_IDCT_NEG, PLM_IDCT_RND,
+			block[i], block[i + 1], block[i + 2], block[i + 3],
+			block[i + 4], block[i + 5], block[i + 6], block[i + 7]);
+	}
+}
+
+// Clears the coefficients of the first row or column of the block; the
+// only ones that can be non-zero for these variants.
+
+void plm_video_idct_clear_first(int *block, int variant) {
+	for (int i = 0; i < 8; i++) {
+		block[variant == PLM_VIDEO_IDCT_FIRST_ROW ? i : i * 8] = 0;
+	}
+}
+
+static inline void plm_video_idct_store_scalar(int *block, uint8_t *dest, int stride, int variant, int add) {
+	switch (variant) {
+		case PLM_VIDEO_IDCT_FIRST_ROW: plm_video_idct_first_row(block); break;
+		case PLM_VIDEO_IDCT_FIRST_COLUMN: plm_video_idct_first_column(block); break;
+		case PLM_VIDEO_IDCT_TOP_LEFT_4X4: plm_video_idct_top_left_4x4(block); break;
+		default: plm_video_idct(block); break;
+	}
+
+	// The first row/column variants have one result per column/row
+	int row_step = variant == PLM_VIDEO_IDCT_FIRST_ROW ? 0 : 8;
+	int col_step = variant == PLM_VIDEO_IDCT_FIRST_COLUMN ? 0 : 1;
+	for (int y = 0; y < 8; y++) {
+		for (int x = 0; x < 8; x++) {
+			int v = block[y * row_step + x * col_step];
+			dest[y * stride + x] = plm_clamp(add ? dest[y * stride + x] + v : v);
+		}
+	}
+
+	if (variant == PLM_VIDEO_IDCT_FIRST_ROW || variant == PLM_VIDEO_IDCT_FIRST_COLUMN) {
+		plm_video_idct_clear_first(block, variant);
+	}
+	else {
+		memset(block, 0, 64 * sizeof(int));
+	}
+}
+
+void plm_video_idct_put_scalar(int *block, uint8_t *dest, int stride, int variant) {
+	plm_video_idct_store_scalar(block, dest, stride, variant, FALSE);
+}
+
+void plm_video_idct_add_scalar(int *block, uint8_t *dest, int stride, int variant) {
+	plm_video_idct_store_scalar(block, dest, stride, variant, TRUE);
+}
+
+#ifdef PLM_SIMD_X86
+
+// SSE2 has no 32 bit multiply; combine the low halves of two pmuludq
+
+PLM_SIMD_TARGET("sse2")
+static inline __m128i plm_sse2_mullo_epi32(__m128i a, int c) {
+	__m128i vc = _mm_set1_epi32(c);
+	__m128i even = _mm_mul_epu32(a, vc);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), vc);
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0))
+	);
+}
+
+#define PLM_SSE2_ADD(A, B) _mm_add_epi32(A, B)
+#define PLM_SSE2_SUB(A, B) _mm_sub_epi32(A, B)
+#define PLM_SSE2_MUL(A, C) plm_sse2_mullo_epi32(A, C)
+#define PLM_SSE2_RND(A) _mm_srai_epi32(_mm_add_epi32(A, _mm_set1_epi32(128)), 8)
+#define PLM_SSE2_NEG(A) _mm_sub_epi32(_mm_setzero_si128(), A)
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_transpose_4x4(__m128i *a, __m128i *b, __m128i *c, __m128i *d) {
+	__m128i t0 = _mm_unpacklo_epi32(*a, *b);
+	__m128i t1 = _mm_unpacklo_epi32(*c, *d);
+	__m128i t2 = _mm_unpackhi_epi32(*a, *b);
+	__m128i t3 = _mm_unpackhi_epi32(*c, *d);
+	*a = _mm_unpacklo_epi64(t0, t1);
+	*b = _mm_unpackhi_epi64(t0, t1);
+	*c = _mm_unpacklo_epi64(t2, t3);
+	*d = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Transposes the 8x8 block held as v[row][half]
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_transpose_8x8(__m128i v[8][2]) {
+	plm_sse2_transpose_4x4(&v[0][0], &v[1][0], &v[2][0], &v[3][0]);
+	plm_sse2_transpose_4x4(&v[4][1], &v[5][1], &v[6][1], &v[7][1]);
+	plm_sse2_transpose_4x4(&v[0][1], &v[1][1], &v[2][1], &v[3][1]);
+	plm_sse2_transpose_4x4(&v[4][0], &v[5][0], &v[6][0], &v[7][0]);
+	for (int i = 0; i < 4; i++) {
+		__m128i t = v[i][1];
+		v[i][1] = v[i + 4][0];
+		v[i + 4][0] = t;
+	}
+}
+
+// The column pass of the top-left 4x4 variant skips the right half, which
+// is all zero.
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_idct(int *block, __m128i v[8][2], int variant) {
+	__m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < 8; i++) {
+		v[i][0] = _mm_loadu_si128((__m128i *)(block + i * 8));
+		v[i][1] = _mm_loadu_si128((__m128i *)(block + i * 8 + 4));
+		_mm_storeu_si128((__m128i *)(block + i * 8), zero);
+		_mm_storeu_si128((__m128i *)(block + i * 8 + 4), zero);
+	}
+	int halves = variant == PLM_VIDEO_IDCT_TOP_LEFT_4X4 ? 1 : 2;
+	for (int h = 0; h < halves; h++) {
+		PLM_IDCT_1D(__m128i, PLM_SSE2_ADD, PLM_SSE2_SUB, PLM_SSE2_MUL, PLM_SSE2_RND, PLM_SSE2_NEG, PLM_IDCT_PASS,
+			v[0][h], v[1][h], v[2][h], v[3][h], v[4][h], v[5][h], v[6][h], v[7][h]);
+	}
+	plm_sse2_transpose_8x8(v);
+	for (int h = 0; h < 2; h++) {
+		PLM_IDCT_1D(__m128i, PLM_SSE2_ADD, PLM_SSE2_SUB, PLM_SSE2_MUL, PLM_SSE2_RND, PLM_SSE2_NEG, PLM_SSE2_RND,
+			v[0][h], v[1][h], v[2][h], v[3][h], v[4][h], v[5][h], v[6][h], v[7][h]);
+	}
+	plm_sse2_transpose_8x8(v);
+}
+
+// Optionally adds a row of 8 saturated 16 bit results to dest with
+// saturation and stores them as clamped bytes.
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_idct_store_row(__m128i row, uint8_t *dest, int add) {
+	if (add) {
+		__m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)dest), _mm_setzero_si128());
+		row = _mm_adds_epi16(row, d);
+	}
+	_mm_storel_epi64((__m128i *)dest, _mm_packus_epi16(row, row));
+}
+
+// Stores the results of the first row or first column variants, which are
+// computed by the scalar code.
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_idct_store_first(int *block, uint8_t *dest, int stride, int variant, int add) {
+	if (variant == PLM_VIDEO_IDCT_FIRST_ROW) {
+		plm_video_idct_first_row(block);
+		__m128i row = _mm_packs_epi32(
+			_mm_loadu_si128((__m128i *)block),
+			_mm_loadu_si128((__m128i *)(block + 4))
+		);
+		for (int i = 0; i < 8; i++) {
+			plm_sse2_idct_store_row(row, dest + i * stride, add);
+		}
+	}
+	else {
+		plm_video_idct_first_column(block);
+		for (int i = 0; i < 8; i++) {
+			__m128i v = _mm_set1_epi32(block[i * 8]);
+			plm_sse2_idct_store_row(_mm_packs_epi32(v, v), dest + i * stride, add);
+		}
+	}
+	plm_video_idct_clear_first(block, variant);
+}
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_idct_store(int *block, uint8_t *dest, int stride, int variant, int add) {
+	if (variant == PLM_VIDEO_IDCT_FIRST_ROW || variant == PLM_VIDEO_IDCT_FIRST_COLUMN) {
+		plm_sse2_idct_store_first(block, dest, stride, variant, add);
+		return;
+	}
+	__m128i v[8][2];
+	plm_sse2_idct(block, v, variant);
+	for (int i = 0; i < 8; i++) {
+		plm_sse2_idct_store_row(_mm_packs_epi32(v[i][0], v[i][1]), dest + i * stride, add);
+	}
+}
+
+PLM_SIMD_TARGET("sse2")
+void plm_video_idct_put_sse2(int *block, uint8_t *dest, int stride, int variant) {
+	plm_sse2_idct_store(block, dest, stride, variant, FALSE);
+}
+
+PLM_SIMD_TARGET("sse2")
+void plm_video_idct_add_sse2(int *block, uint8_t *dest, int stride, int variant) {
+	plm_sse2_idct_store(block, dest, stride, variant, TRUE);
+}
+
+#define PLM_AVX2_ADD(A, B) _mm256_add_epi32(A, B)
+#define PLM_AVX2_SUB(A, B) _mm256_sub_epi32(A, B)
+#define PLM_AVX2_MUL(A, C) _mm256_mullo_epi32(A, _mm256_set1_epi32(C))
+#define PLM_AVX2_RND(A) _mm256_srai_epi32(_mm256_add_epi32(A, _mm256_set1_epi32(128)), 8)
+#define PLM_AVX2_NEG(A) _mm256_sub_epi32(_mm256_setzero_si256(), A)
+
+PLM_SIMD_TARGET("avx2")
+static inline void plm_avx2_transpose_8x8(__m256i v[8]) {
+	__m256i t[8], u[8];
+	for (int i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(v[i], v[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(v[i], v[i + 1]);
+	}
+	for (int i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (int i = 0; i < 4; i++) {
+		v[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		v[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+
+// A full row fits into one register, so the top-left 4x4 variant uses the
+// full transform.
+
+PLM_SIMD_TARGET("avx2")
+static inline void plm_avx2_idct_store(int *block, uint8_t *dest, int stride, int variant, int add) {
+	if (variant == PLM_VIDEO_IDCT_FIRST_ROW || variant == PLM_VIDEO_IDCT_FIRST_COLUMN) {
+		plm_sse2_idct_store_first(block, dest, stride, variant, add);
+		return;
+	}
+
+	__m256i v[8];
+	__m256i zero = _mm256_setzero_si256();
+	for (int i = 0; i < 8; i++) {
+		v[i] = _mm256_loadu_si256((__m256i *)(block + i * 8));
+		_mm256_storeu_si256((__m256i *)(block + i * 8), zero);
+	}
+	PLM_IDCT_1D(__m256i, PLM_AVX2_ADD, PLM_AVX2_SUB, PLM_AVX2_MUL, PLM_AVX2_RND, PLM_AVX2_NEG, PLM_IDCT_PASS,
+		v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+	plm_avx2_transpose_8x8(v);
+	PLM_IDCT_1D(__m256i, PLM_AVX2_ADD, PLM_AVX2_SUB, PLM_AVX2_MUL, PLM_AVX2_RND, PLM_AVX2_NEG, PLM_AVX2_RND,
+		v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+	plm_avx2_transpose_8x8(v);
+
+	for (int i = 0; i < 8; i++) {
+		__m128i row = _mm_packs_epi32(_mm256_castsi256_si128(v[i]), _mm256_extracti128_si256(v[i], 1));
+		plm_sse2_idct_store_row(row, dest + i * stride, add);
+	}
+}
+
+PLM_SIMD_TARGET("avx2")
+void plm_video_idct_put_avx2(int *block, uint8_t *dest, int stride, int variant) {
+	plm_avx2_idct_store(block, dest, stride, variant, FALSE);
+}
+
+PLM_SIMD_TARGET("avx2")
+void plm_video_idct_add_avx2(int *block, uint8_t *dest, int stride, int variant) {
+	plm_avx2_idct_store(block, dest, stride, variant, TRUE);
+}
+
+#undef PLM_SSE2_ADD
+#undef PLM_SSE2_SUB
+#undef PLM_SSE2_MUL
+#undef PLM_SSE2_RND
+#undef PLM_SSE2_NEG
+#undef PLM_AVX2_ADD
+#undef PLM_AVX2_SUB
+#undef PLM_AVX2_MUL
+#undef PLM_AVX2_RND
+#undef PLM_AVX2_NEG
+
+#endif // PLM_SIMD_X86
+
+#ifdef PLM_SIMD_NEON
+
+#define PLM_NEON_ADD(A, B) vaddq_s32(A, B)
+#define PLM_NEON_SUB(A, B) vsubq_s32(A, B)
+#define PLM_NEON_MUL(A, C) vmulq_n_s32(A, C)
+#define PLM_NEON_RND(A) vshrq_n_s32(vaddq_s32(A, vdupq_n_s32(128)), 8)
+#define PLM_NEON_NEG(A) vnegq_s32(A)
+
+static inline void plm_neon_transpose_4x4(int32x4_t *a, int32x4_t *b, int32x4_t *c, int32x4_t *d) {
+	int32x4x2_t t0 = vtrnq_s32(*a, *b);
+	int32x4x2_t t1 = vtrnq_s32(*c, *d);
+	*a = vcombine_s32(vget_low_s32(t0.val[0]), vget_low_s32(t1.val[0]));
+	*b = vcombine_s32(vget_low_s32(t0.val[1]), vget_low_s32(t1.val[1]));
+	*c = vcombine_s32(vget_high_s32(t0.val[0]), vget_high_s32(t1.val[0]));
+	*d = vcombine_s32(vget_high_s32(t0.val[1]), vget_high_s32(t1.val[1]));
+}
+
+static inline void plm_neon_transpose_8x8(int32x4_t v[8][2]) {
+	plm_neon_transpose_4x4(&v[0][0], &v[1][0], &v[2][0], &v[3][0]);
+	plm_neon_transpose_4x4(&v[4][1], &v[5][1], &v[6][1], &v[7][1]);
+	plm_neon_transpose_4x4(&v[0][1], &v[1][1], &v[2][1], &v[3][1]);
+	plm_neon_transpose_4x4(&v[4][0], &v[5][0], &v[6][0], &v[7][0]);
+	for (int i = 0; i < 4; i++) {
+		int32x4_t t = v[i][1];
+		v[i][1] = v[i + 4][0];
+		v[i + 4][0] = t;
+	}
+}
+
+static inline void plm_neon_idct_store_row(int16x8_t row, uint8_t *dest, int add) {
+	if (add) {
+		row = vqaddq_s16(row, vreinterpretq_s16_u16(vmovl_u8(vld1_u8(dest))));
+	}
+	vst1_u8(dest, vqmovun_s16(row));
+}
+
+static inline void plm_neon_idct_store(int *block, uint8_t *dest, int stride, int variant, int add) {
+	if (variant == PLM_VIDEO_IDCT_FIRST_ROW) {
+		plm_video_idct_first_row(block);
+		int16x8_t row = vcombine_s16(vqmovn_s32(vld1q_s32(block)), vqmovn_s32(vld1q_s32(block + 4)));
+		for (int i = 0; i < 8; i++) {
+			plm_neon_idct_store_row(row, dest + i * stride, add);
+		}
+		plm_video_idct_clear_first(block, variant);
+		return;
+	}
+	if (variant == PLM_VIDEO_IDCT_FIRST_COLUMN) {
+		plm_video_idct_first_column(block);
+		for (int i = 0; i < 8; i++) {
+			int16x4_t v = vqmovn_s32(vdupq_n_s32(block[i * 8]));
+			plm_neon_idct_store_row(vcombine_s16(v, v), dest + i * stride, add);
+		}
+		plm_video_idct_clear_first(block, variant);
+		return;
+	}
+
+	int32x4_t v[8][2];
+	int32x4_t zero = vdupq_n_s32(0);
+	for (int i = 0; i < 8; i++) {
+		v[i][0] = vld1q_s32(block + i * 8);
+		v[i][1] = vld1q_s32(block + i * 8 + 4);
+		vst1q_s32(block + i * 8, zero);
+		vst1q_s32(block + i * 8 + 4, zero);
+	}
+	int halves = variant == PLM_VIDEO_IDCT_TOP_LEFT_4X4 ? 1 : 2;
+	for (int h = 0; h < halves; h++) {
+		PLM_IDCT_1D(int32x4_t, PLM_NEON_ADD, PLM_NEON_SUB, PLM_NEON_MUL, PLM_NEON_RND, PLM_NEON_NEG, PLM_IDCT_PASS,
+			v[0][h], v[1][h], v[2][h], v[3][h], v[4][h], v[5][h], v[6][h], v[7][h]);
+	}
+	plm_neon_transpose_8x8(v);
+	for (int h = 0; h < 2; h++) {
+		PLM_IDCT_1D(int32x4_t, PLM_NEON_ADD, PLM_NEON_SUB, PLM_NEON_MUL, PLM_NEON_RND, PLM_NEON_NEG, PLM_NEON_RND,
+			v[0][h], v[1][h], v[2][h], v[3][h], v[4][h], v[5][h], v[6][h], v[7][h]);
+	}
+	plm_neon_transpose_8x8(v);
+
+	for (int i = 0; i < 8; i++) {
+		int16x8_t row = vcombine_s16(vqmovn_s32(v[i][0]), vqmovn_s32(v[i][1]));
+		plm_neon_idct_store_row(row, dest + i * stride, add);
+	}
+}
+
+void plm_video_idct_put_neon(int *block, uint8_t *dest, int stride, int variant) {
+	plm_neon_idct_store(block, dest, stride, variant, FALSE);
+}
+
+void plm_video_idct_add_neon(int *block, uint8_t *dest, int stride, int variant) {
+	plm_neon_idct_store(block, dest, stride, variant, TRUE);
+}
+
+#undef PLM_NEON_ADD
+#undef PLM_NEON_SUB
+#undef PLM_NEON_MUL
+#undef PLM_NEON_RND
+#undef PLM_NEON_NEG
+
+#endif // PLM_SIMD_NEON
+
+#undef PLM_IDCT_1D
+#undef PLM_IDCT_PASS
+#undef PLM_IDCT_ADD
+#undef PLM_IDCT_SUB
+#undef PLM_IDCT_MUL
+#undef PLM_IDCT_RND
+#undef PLM_IDCT_NEG
+
+void plm_video_init_idct(plm_video_t *self) {
+	int features = plm_cpu_features();
+	PLM_UNUSED(features);
+
+	self->idct_put = plm_video_idct_put_scalar;
+	self->idct_add = plm_video_idct_add_scalar;
+
+	#if defined(PLM_SIMD_X86)
+		if (features & PLM_CPU_AVX2) {
+			self->idct_put = plm_video_idct_put_avx2;
+			self->idct_add = plm_video_idct_add_avx2;
+		}
+		else if (features & PLM_CPU_SSE2) {
+			self->idct_put = plm_video_idct_put_sse2;
+			self->idct_add = plm_video_idct_add_sse2;
+		}
+	#elif defined(PLM_SIMD_NEON)
+		if (features & PLM_CPU_NEON) {
+			self->idct_put = plm_video_idct_put_neon;
+			self->idct_add = plm_video_idct_add_neon;
+		}
+	#endif
+}
+
 // YCbCr conversion following the BT.601 standard:
 // https://infogalactic.com/info/YCbCr#ITU-R_BT.601_conversion
 
+// Fixed point coefficients of the conversion. An intensity below 256 is folded
+// into them, along with the largest value written, so that fading the frame 
+// costs nothing on top of converting it. Both green coefficients are kept even
+// for the SIMD functions, which multiply by their halves.
+
+typedef struct {
+	int y;
+	int r;
+	int g_cb;
+	int g_cr;
+	int b;
+	int max;
+} plm_frame_coeffs_t;
+
+typedef void(*plm_frame_convert_t)(plm_frame_t *frame, uint8_t *dest, int stride, plm_frame_coeffs_t coeffs);
+
+enum plm_frame_format {
+	PLM_FRAME_FORMAT_RGB,
+	PLM_FRAME_FORMAT_BGR,
+	PLM_FRAME_FORMAT_RGBA,
+	PLM_FRAME_FORMAT_BGRA,
+	PLM_FRAME_FORMAT_ARGB,
+	PLM_FRAME_FORMAT_ABGR,
+	PLM_FRAME_FORMAT_COUNT
+};
+
+plm_frame_convert_t plm_frame_get_convert_function(enum plm_frame_format format);
+plm_frame_coeffs_t plm_frame_get_coeffs(int intensity);
+
+plm_frame_coeffs_t plm_frame_get_coeffs(int intensity) {
+	plm_frame_coeffs_t coeffs = {76309, 104597, 25674, 53278, 132201, 255};
+	if (intensity >= 256) {
+		return coeffs;
+	}
+	if (intensity < 0) {
+		intensity = 0;
+	}
+
+	coeffs.y = (coeffs.y * intensity + 128) >> 8;
+	coeffs.r = (coeffs.r * intensity + 128) >> 8;
+	coeffs.g_cb = ((coeffs.g_cb * intensity + 256) >> 9) << 1;
+	coeffs.g_cr = ((coeffs.g_cr * intensity + 256) >> 9) << 1;
+	coeffs.b = (coeffs.b * intensity + 128) >> 8;
+	coeffs.max = (255 * intensity + 128) >> 8;
+	return coeffs;
+}
+
+static inline uint8_t plm_frame_clamp(int n, int max) {
+	if (n > max) {
+		n = max;
+	}
+	else if (n < 0) {
+		n = 0;
+	}
+	return n;
+}
+
 #define PLM_PUT_PIXEL(RI, GI, BI, Y_OFFSET, DEST_OFFSET) \
-	y = ((frame->y.data[y_index + Y_OFFSET]-16) * 76309) >> 16; \
-	dest[d_index + DEST_OFFSET + RI] = plm_clamp(y + r); \
-	dest[d_index + DEST_OFFSET + GI] = plm_clamp(y - g); \
-	dest[d_index + DEST_OFFSET + BI] = plm_clamp(y + b);
+	y = ((frame->y.data[y_index + Y_OFFSET]-16) * coeffs.y) >> 16; \
+	dest[d_index + DEST_OFFSET + RI] = plm_frame_clamp(y + r, coeffs.max); \
+	dest[d_index + DEST_OFFSET + GI] = plm_frame_clamp(y - g, coeffs.max); \
+	dest[d_index + DEST_OFFSET + BI] = plm_frame_clamp(y + b, coeffs.max);
+
+// Converts the 2x2 pixels sharing the chroma sample at c_index and advances
+// all indices to the next chroma sample. Used by the scalar functions and for
+// the remaining columns of the SIMD functions.
+
+#define PLM_CONVERT_CHROMA_SAMPLE(BYTES_PER_PIXEL, RI, GI, BI) do { \
+	int y; \
+	int cr = frame->cr.data[c_index] - 128; \
+	int cb = frame->cb.data[c_index] - 128; \
+	int r = (cr * coeffs.r) >> 16; \
+	int g = (cb * coeffs.g_cb + cr * coeffs.g_cr) >> 16; \
+	int b = (cb * coeffs.b) >> 16; \
+	PLM_PUT_PIXEL(RI, GI, BI, 0,      0); \
+	PLM_PUT_PIXEL(RI, GI, BI, 1,      BYTES_PER_PIXEL); \
+	PLM_PUT_PIXEL(RI, GI, BI, yw,     stride); \
+	PLM_PUT_PIXEL(RI, GI, BI, yw + 1, stride + BYTES_PER_PIXEL); \
+	c_index += 1; \
+	y_index += 2; \
+	d_index += 2 * BYTES_PER_PIXEL; \
+	} while(FALSE)
 
 #define PLM_DEFINE_FRAME_CONVERT_FUNCTION(NAME, BYTES_PER_PIXEL, RI, GI, BI) \
-	void NAME(plm_frame_t *frame, uint8_t *dest, int stride) { \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride, plm_frame_coeffs_t coeffs) { \
 		int cols = frame->width >> 1; \
 		int rows = frame->height >> 1; \
 		int yw = frame->y.width; \
@@ -3447,33 +6020,1149 @@ void plm_video_idct(int *block) {
 			int y_index = row * 2 * yw; \
 			int d_index = row * 2 * stride; \
 			for (int col = 0; col < cols; col++) { \
-				int y; \
-				int cr = frame->cr.data[c_index] - 128; \
-				int cb = frame->cb.data[c_index] - 128; \
-				int r = (cr * 104597) >> 16; \
-				int g = (cb * 25674 + cr * 53278) >> 16; \
-				int b = (cb * 132201) >> 16; \
-				PLM_PUT_PIXEL(RI, GI, BI, 0,      0); \
-				PLM_PUT_PIXEL(RI, GI, BI, 1,      BYTES_PER_PIXEL); \
-				PLM_PUT_PIXEL(RI, GI, BI, yw,     stride); \
-				PLM_PUT_PIXEL(RI, GI, BI, yw + 1, stride + BYTES_PER_PIXEL); \
-				c_index += 1; \
-				y_index += 2; \
-				d_index += 2 * BYTES_PER_PIXEL; \
+				PLM_CONVERT_CHROMA_SAMPLE(BYTES_PER_PIXEL, RI, GI, BI); \
+			} \
+		} \
+	}
+
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgb_scalar,  3, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgr_scalar,  3, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgba_scalar, 4, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgra_scalar, 4, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_argb_scalar, 4, 1, 2, 3)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_abgr_scalar, 4, 3, 2, 1)
+
+
+// The SIMD functions below compute the exact same fixed point products as the
+// scalar code. The coefficients are split into (v * 32) * hi + v * lo pairs, 
+// e.g. 76309 = 2384 * 32 + 21, so that they can be multiplied with 16 bit lanes
+// via pmaddwd (or widened to 32 bit lanes on NEON), followed by the same 
+// arithmetic right shift. Clamping is done by the saturating pack to unsigned 
+// bytes and a minimum with the largest value.
+
+// Selects the channel vector that goes into byte I of a pixel. The remaining
+// byte (alpha) is left untouched in dest.
+
+#define PLM_SIMD_CHANNEL(I, RI, GI, BI, R, G, B, Z) \
+	((I) == (RI) ? (R) : (I) == (GI) ? (G) : (I) == (BI) ? (B) : (Z))
+
+#define PLM_SIMD_ALPHA_INDEX(RI, GI, BI) (6 - (RI) - (GI) - (BI))
+
+#define PLM_SIMD_COEFF(HI, LO) ((int)(((unsigned int)(LO) << 16) | (HI)))
+
+#define PLM_SIMD_COEFF_SPLIT(C) PLM_SIMD_COEFF((C) >> 5, (C) & 31)
+
+#ifdef PLM_SIMD_X86
+
+typedef struct {
+	__m128i y;
+	__m128i r;
+	__m128i g;
+	__m128i b;
+	__m128i max;
+} plm_sse2_coeffs_t;
+
+PLM_SIMD_TARGET("sse2")
+static inline plm_sse2_coeffs_t plm_sse2_get_coeffs(plm_frame_coeffs_t coeffs) {
+	plm_sse2_coeffs_t k;
+	k.y = _mm_set1_epi32(PLM_SIMD_COEFF_SPLIT(coeffs.y));
+	k.r = _mm_set1_epi32(PLM_SIMD_COEFF_SPLIT(coeffs.r));
+	k.g = _mm_set1_epi32(PLM_SIMD_COEFF(coeffs.g_cb >> 1, coeffs.g_cr >> 1));
+	k.b = _mm_set1_epi32(PLM_SIMD_COEFF_SPLIT(coeffs.b));
+	k.max = _mm_set1_epi8((char)coeffs.max);
+	return k;
+}
+
+// (v * coeff) >> 16 for 8 signed 16 bit lanes
+
+PLM_SIMD_TARGET("sse2")
+static inline __m128i plm_sse2_mul_shift(__m128i v, __m128i coeff) {
+	__m128i v32 = _mm_slli_epi16(v, 5);
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(v32, v), coeff);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(v32, v), coeff);
+	return _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16));
+}
+
+// Converts 8 chroma samples and the 2x16 luma samples covered by them into
+// R, G, B byte vectors for both rows.
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_convert_block(
+	const uint8_t *y0, const uint8_t *y1, const uint8_t *cb, const uint8_t *cr,
+	const plm_sse2_coeffs_t *k, __m128i rgb[2][3]
+) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i c128 = _mm_set1_epi16(128);
+	__m128i c16 = _mm_set1_epi16(16);
+
+	__m128i vcb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)cb), zero), c128);
+	__m128i vcr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)cr), zero), c128);
+
+	__m128i r = plm_sse2_mul_shift(vcr, k->r);
+	__m128i b = plm_sse2_mul_shift(vcb, k->b);
+	__m128i g = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(vcb, vcr), k->g), 15),
+		_mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(vcb, vcr), k->g), 15)
+	);
+
+	// Each chroma sample covers two horizontal pixels
+	__m128i r_lo = _mm_unpacklo_epi16(r, r), r_hi = _mm_unpackhi_epi16(r, r);
+	__m128i g_lo = _mm_unpacklo_epi16(g, g), g_hi = _mm_unpackhi_epi16(g, g);
+	__m128i b_lo = _mm_unpacklo_epi16(b, b), b_hi = _mm_unpackhi_epi16(b, b);
+
+	const uint8_t *luma[2] = {y0, y1};
+	for (int i = 0; i < 2; i++) {
+		__m128i vy = _mm_loadu_si128((const __m128i *)luma[i]);
+		__m128i y_lo = _mm_sub_epi16(_mm_unpacklo_epi8(vy, zero), c16);
+		__m128i y_hi = _mm_sub_epi16(_mm_unpackhi_epi8(vy, zero), c16);
+		y_lo = plm_sse2_mul_shift(y_lo, k->y);
+		y_hi = plm_sse2_mul_shift(y_hi, k->y);
+
+		rgb[i][0] = _mm_min_epu8(_mm_packus_epi16(_mm_add_epi16(y_lo, r_lo), _mm_add_epi16(y_hi, r_hi)), k->max);
+		rgb[i][1] = _mm_min_epu8(_mm_packus_epi16(_mm_sub_epi16(y_lo, g_lo), _mm_sub_epi16(y_hi, g_hi)), k->max);
+		rgb[i][2] = _mm_min_epu8(_mm_packus_epi16(_mm_add_epi16(y_lo, b_lo), _mm_add_epi16(y_hi, b_hi)), k->max);
+	}
+}
+
+// Interleaves 16 pixels from 4 byte vectors and stores them, keeping the bytes
+// selected by the keep mask from dest.
+
+PLM_SIMD_TARGET("sse2")
+static inline void plm_sse2_store_4(
+	uint8_t *dest, __m128i c0, __m128i c1, __m128i c2, __m128i c3, __m128i keep
+) {
+	__m128i t0 = _mm_unpacklo_epi8(c0, c1);
+	__m128i t1 = _mm_unpacklo_epi8(c2, c3);
+	__m128i t2 = _mm_unpackhi_epi8(c0, c1);
+	__m128i t3 = _mm_unpackhi_epi8(c2, c3);
+	__m128i px[4] = {
+		_mm_unpacklo_epi16(t0, t1), _mm_unpackhi_epi16(t0, t1),
+		_mm_unpacklo_epi16(t2, t3), _mm_unpackhi_epi16(t2, t3)
+	};
+	for (int i = 0; i < 4; i++) {
+		__m128i *d = (__m128i *)(dest + i * 16);
+		_mm_storeu_si128(d, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(d), keep), px[i]));
+	}
+}
+
+// Interleaves 16 pixels from 3 byte vectors into 48 bytes via pshufb
+
+#define PLM_SSSE3_SHUFFLE_BYTE(P, J, I) \
+	((((J) * 16 + (I)) % 3 == (P)) ? (((J) * 16 + (I)) / 3) : -128)
+
+#define PLM_SSSE3_SHUFFLE(P, J) _mm_setr_epi8( \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J,  0), PLM_SSSE3_SHUFFLE_BYTE(P, J,  1), \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J,  2), PLM_SSSE3_SHUFFLE_BYTE(P, J,  3), \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J,  4), PLM_SSSE3_SHUFFLE_BYTE(P, J,  5), \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J,  6), PLM_SSSE3_SHUFFLE_BYTE(P, J,  7), \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J,  8), PLM_SSSE3_SHUFFLE_BYTE(P, J,  9), \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J, 10), PLM_SSSE3_SHUFFLE_BYTE(P, J, 11), \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J, 12), PLM_SSSE3_SHUFFLE_BYTE(P, J, 13), \
+	PLM_SSSE3_SHUFFLE_BYTE(P, J, 14), PLM_SSSE3_SHUFFLE_BYTE(P, J, 15))
+
+PLM_SIMD_TARGET("ssse3")
+static inline void plm_ssse3_store_3(uint8_t *dest, __m128i c0, __m128i c1, __m128i c2) {
+	#define PLM_SSSE3_STORE_CHUNK(J) \
+		_mm_storeu_si128((__m128i *)(dest + (J) * 16), _mm_or_si128(_mm_or_si128( \
+			_mm_shuffle_epi8(c0, PLM_SSSE3_SHUFFLE(0, J)), \
+			_mm_shuffle_epi8(c1, PLM_SSSE3_SHUFFLE(1, J))), \
+			_mm_shuffle_epi8(c2, PLM_SSSE3_SHUFFLE(2, J))))
+
+	PLM_SSSE3_STORE_CHUNK(0);
+	PLM_SSSE3_STORE_CHUNK(1);
+	PLM_SSSE3_STORE_CHUNK(2);
+
+	#undef PLM_SSSE3_STORE_CHUNK
+}
+
+#define PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSE2(NAME, RI, GI, BI) \
+	PLM_SIMD_TARGET("sse2") \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride, plm_frame_coeffs_t coeffs) { \
+		int cols = frame->width >> 1; \
+		int rows = frame->height >> 1; \
+		int yw = frame->y.width; \
+		int cw = frame->cb.width; \
+		plm_sse2_coeffs_t k = plm_sse2_get_coeffs(coeffs); \
+		__m128i zero = _mm_setzero_si128(); \
+		__m128i keep = _mm_set1_epi32((int)(0xffu << (PLM_SIMD_ALPHA_INDEX(RI, GI, BI) * 8))); \
+		for (int row = 0; row < rows; row++) { \
+			int c_index = row * cw; \
+			int y_index = row * 2 * yw; \
+			int d_index = row * 2 * stride; \
+			int col = 0; \
+			for (; col + 8 <= cols; col += 8) { \
+				__m128i rgb[2][3]; \
+				plm_sse2_convert_block( \
+					frame->y.data + y_index, frame->y.data + y_index + yw, \
+					frame->cb.data + c_index, frame->cr.data + c_index, &k, rgb \
+				); \
+				for (int i = 0; i < 2; i++) { \
+					plm_sse2_store_4(dest + d_index + i * stride, \
+						PLM_SIMD_CHANNEL(0, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						PLM_SIMD_CHANNEL(1, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						PLM_SIMD_CHANNEL(2, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						PLM_SIMD_CHANNEL(3, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						keep \
+					); \
+				} \
+				c_index += 8; \
+				y_index += 16; \
+				d_index += 16 * 4; \
+			} \
+			for (; col < cols; col++) { \
+				PLM_CONVERT_CHROMA_SAMPLE(4, RI, GI, BI); \
 			} \
 		} \
 	}
 
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgb,  3, 0, 1, 2)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgr,  3, 2, 1, 0)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgba, 4, 0, 1, 2)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgra, 4, 2, 1, 0)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_argb, 4, 1, 2, 3)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_abgr, 4, 3, 2, 1)
+#define PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSSE3(NAME, RI, GI, BI) \
+	PLM_SIMD_TARGET("ssse3") \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride, plm_frame_coeffs_t coeffs) { \
+		int cols = frame->width >> 1; \
+		int rows = frame->height >> 1; \
+		int yw = frame->y.width; \
+		int cw = frame->cb.width; \
+		plm_sse2_coeffs_t k = plm_sse2_get_coeffs(coeffs); \
+		for (int row = 0; row < rows; row++) { \
+			int c_index = row * cw; \
+			int y_index = row * 2 * yw; \
+			int d_index = row * 2 * stride; \
+			int col = 0; \
+			for (; col + 8 <= cols; col += 8) { \
+				__m128i rgb[2][3]; \
+				plm_sse2_convert_block( \
+					frame->y.data + y_index, frame->y.data + y_index + yw, \
+					frame->cb.data + c_index, frame->cr.data + c_index, &k, rgb \
+				); \
+				for (int i = 0; i < 2; i++) { \
+					plm_ssse3_store_3(dest + d_index + i * stride, \
+						PLM_SIMD_CHANNEL(0, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], rgb[i][0]), \
+						PLM_SIMD_CHANNEL(1, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], rgb[i][0]), \
+						PLM_SIMD_CHANNEL(2, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], rgb[i][0]) \
+					); \
+				} \
+				c_index += 8; \
+				y_index += 16; \
+				d_index += 16 * 3; \
+			} \
+			for (; col < cols; col++) { \
+				PLM_CONVERT_CHROMA_SAMPLE(3, RI, GI, BI); \
+			} \
+		} \
+	}
+
+typedef struct {
+	__m256i y;
+	__m256i r;
+	__m256i g;
+	__m256i b;
+	__m256i max;
+} plm_avx2_coeffs_t;
+
+PLM_SIMD_TARGET("avx2")
+static inline plm_avx2_coeffs_t plm_avx2_get_coeffs(plm_frame_coeffs_t coeffs) {
+	plm_avx2_coeffs_t k;
+	k.y = _mm256_set1_epi32(PLM_SIMD_COEFF_SPLIT(coeffs.y));
+	k.r = _mm256_set1_epi32(PLM_SIMD_COEFF_SPLIT(coeffs.r));
+	k.g = _mm256_set1_epi32(PLM_SIMD_COEFF(coeffs.g_cb >> 1, coeffs.g_cr >> 1));
+	k.b = _mm256_set1_epi32(PLM_SIMD_COEFF_SPLIT(coeffs.b));
+	k.max = _mm256_set1_epi8((char)coeffs.max);
+	return k;
+}
+
+PLM_SIMD_TARGET("avx2")
+static inline __m256i plm_avx2_mul_shift(__m256i v, __m256i coeff) {
+	__m256i v32 = _mm256_slli_epi16(v, 5);
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(v32, v), coeff);
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(v32, v), coeff);
+	return _mm256_packs_epi32(_mm256_srai_epi32(lo, 16), _mm256_srai_epi32(hi, 16));
+}
+
+// Same as plm_sse2_convert_block(), but for 16 chroma and 2x32 luma samples.
+// The in-lane unpack and pack instructions cancel each other out, so the
+// resulting byte vectors are in pixel order.
+
+PLM_SIMD_TARGET("avx2")
+static inline void plm_avx2_convert_block(
+	const uint8_t *y0, const uint8_t *y1, const uint8_t *cb, const uint8_t *cr,
+	const plm_avx2_coeffs_t *k, __m256i rgb[2][3]
+) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i c128 = _mm256_set1_epi16(128);
+	__m256i c16 = _mm256_set1_epi16(16);
+
+	__m256i vcb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)cb)), c128);
+	__m256i vcr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)cr)), c128);
+
+	__m256i r = plm_avx2_mul_shift(vcr, k->r);
+	__m256i b = plm_avx2_mul_shift(vcb, k->b);
+	__m256i g = _mm256_packs_epi32(
+		_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(vcb, vcr), k->g), 15),
+		_mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(vcb, vcr), k->g), 15)
+	);
+
+	// Lane order after this is [0-7 | 16-23] for _lo and [8-15 | 24-31] for _hi
+	__m256i r_lo = _mm256_unpacklo_epi16(r, r), r_hi = _mm256_unpackhi_epi16(r, r);
+	__m256i g_lo = _mm256_unpacklo_epi16(g, g), g_hi = _mm256_unpackhi_epi16(g, g);
+	__m256i b_lo = _mm256_unpacklo_epi16(b, b), b_hi = _mm256_unpackhi_epi16(b, b);
+
+	const uint8_t *luma[2] = {y0, y1};
+	for (int i = 0; i < 2; i++) {
+		__m256i vy = _mm256_loadu_si256((const __m256i *)luma[i]);
+		__m256i y_lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(vy, zero), c16);
+		__m256i y_hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(vy, zero), c16);
+		y_lo = plm_avx2_mul_shift(y_lo, k->y);
+		y_hi = plm_avx2_mul_shift(y_hi, k->y);
+
+		rgb[i][0] = _mm256_min_epu8(_mm256_packus_epi16(_mm256_add_epi16(y_lo, r_lo), _mm256_add_epi16(y_hi, r_hi)), k->max);
+		rgb[i][1] = _mm256_min_epu8(_mm256_packus_epi16(_mm256_sub_epi16(y_lo, g_lo), _mm256_sub_epi16(y_hi, g_hi)), k->max);
+		rgb[i][2] = _mm256_min_epu8(_mm256_packus_epi16(_mm256_add_epi16(y_lo, b_lo), _mm256_add_epi16(y_hi, b_hi)), k->max);
+	}
+}
+
+PLM_SIMD_TARGET("avx2")
+static inline void plm_avx2_store_4(
+	uint8_t *dest, __m256i c0, __m256i c1, __m256i c2, __m256i c3, __m256i keep
+) {
+	__m256i t0 = _mm256_unpacklo_epi8(c0, c1);
+	__m256i t1 = _mm256_unpacklo_epi8(c2, c3);
+	__m256i t2 = _mm256_unpackhi_epi8(c0, c1);
+	__m256i t3 = _mm256_unpackhi_epi8(c2, c3);
+	__m256i q0 = _mm256_unpacklo_epi16(t0, t1); // 0-3   | 16-19
+	__m256i q1 = _mm256_unpackhi_epi16(t0, t1); // 4-7   | 20-23
+	__m256i q2 = _mm256_unpacklo_epi16(t2, t3); // 8-11  | 24-27
+	__m256i q3 = _mm256_unpackhi_epi16(t2, t3); // 12-15 | 28-31
+	__m256i px[4] = {
+		_mm256_permute2x128_si256(q0, q1, 0x20), _mm256_permute2x128_si256(q2, q3, 0x20),
+		_mm256_permute2x128_si256(q0, q1, 0x31), _mm256_permute2x128_si256(q2, q3, 0x31)
+	};
+	for (int i = 0; i < 4; i++) {
+		__m256i *d = (__m256i *)(dest + i * 32);
+		_mm256_storeu_si256(d, _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(d), keep), px[i]));
+	}
+}
+
+#define PLM_DEFINE_FRAME_CONVERT_FUNCTION_AVX2(NAME, RI, GI, BI) \
+	PLM_SIMD_TARGET("avx2") \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride, plm_frame_coeffs_t coeffs) { \
+		int cols = frame->width >> 1; \
+		int rows = frame->height >> 1; \
+		int yw = frame->y.width; \
+		int cw = frame->cb.width; \
+		plm_avx2_coeffs_t k = plm_avx2_get_coeffs(coeffs); \
+		plm_sse2_coeffs_t k_128 = plm_sse2_get_coeffs(coeffs); \
+		__m256i zero = _mm256_setzero_si256(); \
+		__m256i keep = _mm256_set1_epi32((int)(0xffu << (PLM_SIMD_ALPHA_INDEX(RI, GI, BI) * 8))); \
+		for (int row = 0; row < rows; row++) { \
+			int c_index = row * cw; \
+			int y_index = row * 2 * yw; \
+			int d_index = row * 2 * stride; \
+			int col = 0; \
+			for (; col + 16 <= cols; col += 16) { \
+				__m256i rgb[2][3]; \
+				plm_avx2_convert_block( \
+					frame->y.data + y_index, frame->y.data + y_index + yw, \
+					frame->cb.data + c_index, frame->cr.data + c_index, &k, rgb \
+				); \
+				for (int i = 0; i < 2; i++) { \
+					plm_avx2_store_4(dest + d_index + i * stride, \
+						PLM_SIMD_CHANNEL(0, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						PLM_SIMD_CHANNEL(1, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						PLM_SIMD_CHANNEL(2, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						PLM_SIMD_CHANNEL(3, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero), \
+						keep \
+					); \
+				} \
+				c_index += 16; \
+				y_index += 32; \
+				d_index += 32 * 4; \
+			} \
+			if (col + 8 <= cols) { \
+				__m128i rgb[2][3]; \
+				__m128i zero_128 = _mm_setzero_si128(); \
+				plm_sse2_convert_block( \
+					frame->y.data + y_index, frame->y.data + y_index + yw, \
+					frame->cb.data + c_index, frame->cr.data + c_index, &k_128, rgb \
+				); \
+				for (int i = 0; i < 2; i++) { \
+					plm_sse2_store_4(dest + d_index + i * stride, \
+						PLM_SIMD_CHANNEL(0, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero_128), \
+						PLM_SIMD_CHANNEL(1, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero_128), \
+						PLM_SIMD_CHANNEL(2, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero_128), \
+						PLM_SIMD_CHANNEL(3, RI, GI, BI, rgb[i][0], rgb[i][1], rgb[i][2], zero_128), \
+						_mm256_castsi256_si128(keep) \
+					); \
+				} \
+				c_index += 8; \
+				y_index += 16; \
+				d_index += 16 * 4; \
+				col += 8; \
+			} \
+			for (; col < cols; col++) { \
+				PLM_CONVERT_CHROMA_SAMPLE(4, RI, GI, BI); \
+			} \
+		} \
+	}
+
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSSE3(plm_frame_to_rgb_ssse3, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSSE3(plm_frame_to_bgr_ssse3, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSE2(plm_frame_to_rgba_sse2, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSE2(plm_frame_to_bgra_sse2, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSE2(plm_frame_to_argb_sse2, 1, 2, 3)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSE2(plm_frame_to_abgr_sse2, 3, 2, 1)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_AVX2(plm_frame_to_rgba_avx2, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_AVX2(plm_frame_to_bgra_avx2, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_AVX2(plm_frame_to_argb_avx2, 1, 2, 3)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_AVX2(plm_frame_to_abgr_avx2, 3, 2, 1)
+
+#undef PLM_SSSE3_SHUFFLE
+#undef PLM_SSSE3_SHUFFLE_BYTE
+#undef PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSE2
+#undef PLM_DEFINE_FRAME_CONVERT_FUNCTION_SSSE3
+#undef PLM_DEFINE_FRAME_CONVERT_FUNCTION_AVX2
+
+#endif // PLM_SIMD_X86
+
+#ifdef PLM_SIMD_NEON
+
+static inline int16x8_t plm_neon_mul_shift(int16x8_t v, int32_t coeff) {
+	int32x4_t lo = vshrq_n_s32(vmulq_n_s32(vmovl_s16(vget_low_s16(v)), coeff), 16);
+	int32x4_t hi = vshrq_n_s32(vmulq_n_s32(vmovl_s16(vget_high_s16(v)), coeff), 16);
+	return vcombine_s16(vmovn_s32(lo), vmovn_s32(hi));
+}
+
+static inline void plm_neon_convert_block(
+	const uint8_t *y0, const uint8_t *y1, const uint8_t *cb, const uint8_t *cr,
+	const plm_frame_coeffs_t *coeffs, uint8x16_t rgb[2][3]
+) {
+	int16x8_t c128 = vdupq_n_s16(128);
+	int16x8_t c16 = vdupq_n_s16(16);
+	uint8x16_t max = vdupq_n_u8((uint8_t)coeffs->max);
+
+	int16x8_t vcb = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cb))), c128);
+	int16x8_t vcr = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cr))), c128);
+
+	int16x8_t r = plm_neon_mul_shift(vcr, coeffs->r);
+	int16x8_t b = plm_neon_mul_shift(vcb, coeffs->b);
+	int32x4_t g_lo = vmlaq_n_s32(
+		vmulq_n_s32(vmovl_s16(vget_low_s16(vcb)), coeffs->g_cb),
+		vmovl_s16(vget_low_s16(vcr)), coeffs->g_cr
+	);
+	int32x4_t g_hi = vmlaq_n_s32(
+		vmulq_n_s32(vmovl_s16(vget_high_s16(vcb)), coeffs->g_cb),
+		vmovl_s16(vget_high_s16(vcr)), coeffs->g_cr
+	);
+	int16x8_t g = vcombine_s16(vmovn_s32(vshrq_n_s32(g_lo, 16)), vmovn_s32(vshrq_n_s32(g_hi, 16)));
+
+	// Each chroma sample covers two horizontal pixels
+	int16x8x2_t r2 = vzipq_s16(r, r);
+	int16x8x2_t g2 = vzipq_s16(g, g);
+	int16x8x2_t b2 = vzipq_s16(b, b);
+
+	const uint8_t *luma[2] = {y0, y1};
+	for (int i = 0; i < 2; i++) {
+		uint8x16_t vy = vld1q_u8(luma[i]);
+		int16x8_t y_lo = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(vy))), c16);
+		int16x8_t y_hi = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(vy))), c16);
+		y_lo = plm_neon_mul_shift(y_lo, coeffs->y);
+		y_hi = plm_neon_mul_shift(y_hi, coeffs->y);
+
+		rgb[i][0] = vminq_u8(vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, r2.val[0])), vqmovun_s16(vaddq_s16(y_hi, r2.val[1]))), max);
+		rgb[i][1] = vminq_u8(vcombine_u8(vqmovun_s16(vsubq_s16(y_lo, g2.val[0])), vqmovun_s16(vsubq_s16(y_hi, g2.val[1]))), max);
+		rgb[i][2] = vminq_u8(vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, b2.val[0])), vqmovun_s16(vaddq_s16(y_hi, b2.val[1]))), max);
+	}
+}
+
+#define PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON(NAME, BYTES_PER_PIXEL, RI, GI, BI) \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride, plm_frame_coeffs_t coeffs) { \
+		int cols = frame->width >> 1; \
+		int rows = frame->height >> 1; \
+		int yw = frame->y.width; \
+		int cw = frame->cb.width; \
+		for (int row = 0; row < rows; row++) { \
+			int c_index = row * cw; \
+			int y_index = row * 2 * yw; \
+			int d_index = row * 2 * stride; \
+			int col = 0; \
+			for (; col + 8 <= cols; col += 8) { \
+				uint8x16_t rgb[2][3]; \
+				plm_neon_convert_block( \
+					frame->y.data + y_index, frame->y.data + y_index + yw, \
+					frame->cb.data + c_index, frame->cr.data + c_index, &coeffs, rgb \
+				); \
+				for (int i = 0; i < 2; i++) { \
+					uint8_t *d = dest + d_index + i * stride; \
+					if (BYTES_PER_PIXEL == 4) { \
+						uint8x16x4_t px = vld4q_u8(d); \
+						px.val[RI] = rgb[i][0]; \
+						px.val[GI] = rgb[i][1]; \
+						px.val[BI] = rgb[i][2]; \
+						vst4q_u8(d, px); \
+					} \
+					else { \
+						uint8x16x3_t px; \
+						px.val[RI % 3] = rgb[i][0]; \
+						px.val[GI % 3] = rgb[i][1]; \
+						px.val[BI % 3] = rgb[i][2]; \
+						vst3q_u8(d, px); \
+					} \
+				} \
+				c_index += 8; \
+				y_index += 16; \
+				d_index += 16 * BYTES_PER_PIXEL; \
+			} \
+			for (; col < cols; col++) { \
+				PLM_CONVERT_CHROMA_SAMPLE(BYTES_PER_PIXEL, RI, GI, BI); \
+			} \
+		} \
+	}
+
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON(plm_frame_to_rgb_neon,  3, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON(plm_frame_to_bgr_neon,  3, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON(plm_frame_to_rgba_neon, 4, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON(plm_frame_to_bgra_neon, 4, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON(plm_frame_to_argb_neon, 4, 1, 2, 3)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON(plm_frame_to_abgr_neon, 4, 3, 2, 1)
+
+#undef PLM_DEFINE_FRAME_CONVERT_FUNCTION_NEON
+
+#endif // PLM_SIMD_NEON
+
+plm_frame_convert_t plm_frame_get_convert_function(enum plm_frame_format format) {
+	static const plm_frame_convert_t scalar[PLM_FRAME_FORMAT_COUNT] = {
+		plm_frame_to_rgb_scalar, plm_frame_to_bgr_scalar,
+		plm_frame_to_rgba_scalar, plm_frame_to_bgra_scalar,
+		plm_frame_to_argb_scalar, plm_frame_to_abgr_scalar
+	};
+
+	int features = plm_cpu_features();
+	PLM_UNUSED(features);
+
+	#if defined(PLM_SIMD_X86)
+		static const plm_frame_convert_t ssse3[PLM_FRAME_FORMAT_COUNT] = {
+			plm_frame_to_rgb_ssse3, plm_frame_to_bgr_ssse3, NULL, NULL, NULL, NULL
+		};
+		static const plm_frame_convert_t sse2[PLM_FRAME_FORMAT_COUNT] = {
+			NULL, NULL,
+			plm_frame_to_rgba_sse2, plm_frame_to_bgra_sse2,
+			plm_frame_to_argb_sse2, plm_frame_to_abgr_sse2
+		};
+		static const plm_frame_convert_t avx2[PLM_FRAME_FORMAT_COUNT] = {
+			NULL, NULL,
+			plm_frame_to_rgba_avx2, plm_frame_to_bgra_avx2,
+			plm_frame_to_argb_avx2, plm_frame_to_abgr_avx2
+		};
+
+		if ((features & PLM_CPU_AVX2) && avx2[format]) {
+			return avx2[format];
+		}
+		if ((features & PLM_CPU_SSSE3) && ssse3[format]) {
+			return ssse3[format];
+		}
+		if ((features & PLM_CPU_SSE2) && sse2[format]) {
+			return sse2[format];
+		}
+	#elif defined(PLM_SIMD_NEON)
+		static const plm_frame_convert_t neon[PLM_FRAME_FORMAT_COUNT] = {
+			plm_frame_to_rgb_neon, plm_frame_to_bgr_neon,
+			plm_frame_to_rgba_neon, plm_frame_to_bgra_neon,
+			plm_frame_to_argb_neon, plm_frame_to_abgr_neon
+		};
+
+		if (features & PLM_CPU_NEON) {
+			return neon[format];
+		}
+	#endif
+
+	return scalar[format];
+}
+
+#define PLM_DEFINE_FRAME_CONVERT_DISPATCH(NAME, FORMAT) \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride) { \
+		plm_frame_convert_t convert = plm_frame_get_convert_function(FORMAT); \
+		convert(frame, dest, stride, plm_frame_get_coeffs(256)); \
+	}
+
+PLM_DEFINE_FRAME_CONVERT_DISPATCH(plm_frame_to_rgb,  PLM_FRAME_FORMAT_RGB)
+PLM_DEFINE_FRAME_CONVERT_DISPATCH(plm_frame_to_bgr,  PLM_FRAME_FORMAT_BGR)
+PLM_DEFINE_FRAME_CONVERT_DISPATCH(plm_frame_to_rgba, PLM_FRAME_FORMAT_RGBA)
+PLM_DEFINE_FRAME_CONVERT_DISPATCH(plm_frame_to_bgra, PLM_FRAME_FORMAT_BGRA)
+PLM_DEFINE_FRAME_CONVERT_DISPATCH(plm_frame_to_argb, PLM_FRAME_FORMAT_ARGB)
+PLM_DEFINE_FRAME_CONVERT_DISPATCH(plm_frame_to_abgr, PLM_FRAME_FORMAT_ABGR)
+
+
+// Row conversion. Each run of consecutive flagged macroblock rows is converted
+// as a frame of its own, so the SIMD paths are used for these as well. The 
+// intensity goes into the coefficients of the conversion itself.
+
+void plm_frame_convert_rows(
+	plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity,
+	plm_frame_convert_t convert
+);
+
+void plm_frame_convert_rows(
+	plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity,
+	plm_frame_convert_t convert
+) {
+	int mb_rows = (frame->height + 15) >> 4;
+	plm_frame_coeffs_t coeffs = plm_frame_get_coeffs(intensity);
+
+	for (int first = 0; first < mb_rows;) {
+		if (rows && !rows[first]) {
+			first++;
+			continue;
+		}
+
+		int last = first + 1;
+		while (last < mb_rows && (!rows || rows[last])) {
+			last++;
+		}
+
+		int y = first << 4;
+		int end = (last << 4) < (int)frame->height ? (last << 4) : (int)frame->height;
+
+		plm_frame_t band = *frame;
+		band.height = end - y;
+		band.y.height = (last - first) << 4;
+		band.y.data += y * frame->y.width;
+		band.cr.height = (last - first) << 3;
+		band.cr.data += (y >> 1) * frame->cr.width;
+		band.cb.height = (last - first) << 3;
+		band.cb.data += (y >> 1) * frame->cb.width;
+
+		convert(&band, dest + y * stride, stride, coeffs);
+		first = last;
+	}
+}
+
+#define PLM_DEFINE_FRAME_ROWS_FUNCTION(NAME, FORMAT) \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride, const uint8_t *rows, int intensity) { \
+		plm_frame_convert_t convert = plm_frame_get_convert_function(FORMAT); \
+		plm_frame_convert_rows(frame, dest, stride, rows, intensity, convert); \
+	}
+
+PLM_DEFINE_FRAME_ROWS_FUNCTION(plm_frame_to_rgb_rows,  PLM_FRAME_FORMAT_RGB)
+PLM_DEFINE_FRAME_ROWS_FUNCTION(plm_frame_to_bgr_rows,  PLM_FRAME_FORMAT_BGR)
+PLM_DEFINE_FRAME_ROWS_FUNCTION(plm_frame_to_rgba_rows, PLM_FRAME_FORMAT_RGBA)
+PLM_DEFINE_FRAME_ROWS_FUNCTION(plm_frame_to_bgra_rows, PLM_FRAME_FORMAT_BGRA)
+PLM_DEFINE_FRAME_ROWS_FUNCTION(plm_frame_to_argb_rows, PLM_FRAME_FORMAT_ARGB)
+PLM_DEFINE_FRAME_ROWS_FUNCTION(plm_frame_to_abgr_rows, PLM_FRAME_FORMAT_ABGR)
+
+
+// Scaled conversion. The Y plane is scaled to the destination size and the Cr
+// and Cb planes to half of it, a band of lines at a time, and the band then goes
+// through the same conversion as a frame of that size. Each plane is scaled
+// horizontally a source line at a time into one of two line buffers, which are
+// kept for as long as the following destination lines sample from the same
+// source lines, and these are blended vertically into the band.
+//
+// Each destination column and line maps to the source sample before it and the
+// weight (0--256) of the one after it; the nearest filter always has a weight of
+// 0. The centers of the destination pixels are mapped onto the source plane,
+// i.e. (i + 0.5) * src_size / dst_size - 0.5.
+//
+// The SIMD paths gather the source samples of a group of destination columns
+// from 16 consecutive source bytes with a byte shuffle. Groups are 16 columns
+// for the nearest filter and 8 for bilinear, which needs two samples for each.
+// Only the leading groups whose samples fit are gathered, e.g. all of them for
+// upscaling; the remaining columns are scaled one by one.
+
+#define PLM_FRAME_SCALE_BAND 16
+
+typedef struct {
+	int size;
+	int identity;
+	int *index;
+	uint16_t *weight;
+	int group_size;
+	int groups;
+	int *group_index;
+	uint8_t *group_shuffle;
+} plm_frame_scale_taps_t;
+
+typedef void(*plm_frame_scale_line_t)(const plm_frame_scale_taps_t *taps, const uint8_t *src, uint8_t *dest);
+typedef void(*plm_frame_blend_lines_t)(const uint8_t *a, const uint8_t *b, uint8_t *dest, int length, int weight);
+
+struct plm_frame_scaler_t {
+	int filter;
+	int src_width;
+	int src_height;
+	int width;
+	int height;
+	plm_frame_scale_taps_t columns[2];
+	plm_frame_scale_taps_t lines[2];
+	uint8_t *band[3];
+	int band_stride[2];
+	uint8_t *line_buffers[3][2];
+	int line_tags[3][2];
+	void *taps_data;
+	void *buffer_data;
+	plm_frame_scale_line_t scale_line;
+	plm_frame_blend_lines_t blend_lines;
+	plm_frame_convert_t convert[PLM_FRAME_FORMAT_COUNT];
+};
+
+size_t plm_frame_scale_taps_size(int size);
+void plm_frame_scale_taps_init(plm_frame_scale_taps_t *taps, uint8_t *data, int size, int src_size, int filter);
+void plm_frame_scale_line_scalar(const plm_frame_scale_taps_t *taps, const uint8_t *src, uint8_t *dest);
+void plm_frame_blend_lines_scalar(const uint8_t *a, const uint8_t *b, uint8_t *dest, int length, int weight);
+void plm_frame_scaler_resize(plm_frame_scaler_t *self, int src_width, int src_height, int width, int height);
+const uint8_t *plm_frame_scaler_get_line(plm_frame_scaler_t *self, int plane, const plm_plane_t *src, int line);
+void plm_frame_scaler_scale_line(
+	plm_frame_scaler_t *self, int plane, const plm_plane_t *src,
+	const plm_frame_scale_taps_t *lines, int line, uint8_t *dest
+);
+int plm_frame_scaler_band_changed(plm_frame_scaler_t *self, int first, int count, const uint8_t *rows);
+void plm_frame_convert_scaled(
+	plm_frame_scaler_t *self, plm_frame_t *frame, uint8_t *dest, int stride, int width, int height,
+	const uint8_t *rows, int intensity, plm_frame_convert_t convert,
+	int bytes_per_pixel, int ri, int gi, int bi
+);
+
+size_t plm_frame_scale_taps_size(int size) {
+	int groups = (size >> 3) + 1;
+	return
+		((sizeof(int) * size + 15) & ~15) +
+		((sizeof(uint16_t) * size + 15) & ~15) +
+		((sizeof(int) * groups + 15) & ~15) +
+		16 * groups;
+}
+
+void plm_frame_scale_taps_init(plm_frame_scale_taps_t *taps, uint8_t *data, int size, int src_size, int filter) {
+	int groups = (size >> 3) + 1;
+	taps->size = size;
+	taps->index = (int *)data;
+	data += (sizeof(int) * size + 15) & ~15;
+	taps->weight = (uint16_t *)data;
+	data += (sizeof(uint16_t) * size + 15) & ~15;
+	taps->group_index = (int *)data;
+	data += (sizeof(int) * groups + 15) & ~15;
+	taps->group_shuffle = data;
+
+	taps->identity = size == src_size;
+	for (int i = 0; i < size; i++) {
+		int64_t pos = (((int64_t)(2 * i + 1) * src_size) << 15) / size - (1 << 15);
+		int index, weight;
+
+		if (filter == PLM_FRAME_FILTER_NEAREST) {
+			index = (int)((pos + (1 << 15)) >> 16);
+			weight = 0;
+		}
+		else if (pos < 0) {
+			index = 0;
+			weight = 0;
+		}
+		else {
+			index = (int)(pos >> 16);
+			weight = (int)((pos >> 8) & 0xff);
+		}
+
+		if (index >= src_size - 1) {
+			index = src_size - 1;
+			weight = 0;
+		}
+		taps->index[i] = index;
+		taps->weight[i] = weight;
+		taps->identity &= index == i && weight == 0;
+	}
+
+	// Groups have to start at least 16 bytes before the end of the source line
+	// and have all of their samples within these 16 bytes. Nearest groups of 16
+	// only fit when upscaling, otherwise they are blended like bilinear groups
+	// with a weight of 0.
+	taps->group_size = 16;
+	if (
+		filter != PLM_FRAME_FILTER_NEAREST ||
+		size < 16 || taps->index[15] - taps->index[0] > 15
+	) {
+		taps->group_size = 8;
+	}
+
+	taps->groups = 0;
+	for (int g = 0; (g + 1) * taps->group_size <= size; g++) {
+		int *index = taps->index + g * taps->group_size;
+		uint16_t *weight = taps->weight + g * taps->group_size;
+		uint8_t *shuffle = taps->group_shuffle + g * 16;
+		int last = index[taps->group_size - 1] + (weight[taps->group_size - 1] ? 1 : 0);
+		if (index[0] + 16 > src_size || last - index[0] > 15) {
+			break;
+		}
+
+		for (int i = 0; i < taps->group_size; i++) {
+			shuffle[i] = index[i] - index[0];
+			if (taps->group_size == 8) {
+				shuffle[i + 8] = index[i] + (weight[i] ? 1 : 0) - index[0];
+			}
+		}
+		taps->group_index[g] = index[0];
+		taps->groups++;
+	}
+}
+
+static inline void plm_frame_scale_samples(
+	const plm_frame_scale_taps_t *taps, const uint8_t *src, uint8_t *dest, int from
+) {
+	for (int i = from; i < taps->size; i++) {
+		const uint8_t *s = src + taps->index[i];
+		int weight = taps->weight[i];
+		dest[i] = weight
+			? (s[0] * (256 - weight) + s[1] * weight + 128) >> 8
+			: s[0];
+	}
+}
+
+void plm_frame_scale_line_scalar(const plm_frame_scale_taps_t *taps, const uint8_t *src, uint8_t *dest) {
+	plm_frame_scale_samples(taps, src, dest, 0);
+}
+
+void plm_frame_blend_lines_scalar(const uint8_t *a, const uint8_t *b, uint8_t *dest, int length, int weight) {
+	for (int i = 0; i < length; i++) {
+		dest[i] = (a[i] * (256 - weight) + b[i] * weight + 128) >> 8;
+	}
+}
+
+#ifdef PLM_SIMD_X86
+
+PLM_SIMD_TARGET("ssse3")
+void plm_frame_scale_line_ssse3(const plm_frame_scale_taps_t *taps, const uint8_t *src, uint8_t *dest) {
+	if (taps->group_size == 16) {
+		for (int g = 0; g < taps->groups; g++) {
+			__m128i s = _mm_loadu_si128((const __m128i *)(src + taps->group_index[g]));
+			__m128i shuffle = _mm_loadu_si128((const __m128i *)(taps->group_shuffle + g * 16));
+			_mm_storeu_si128((__m128i *)(dest + g * 16), _mm_shuffle_epi8(s, shuffle));
+		}
+	}
+	else {
+		__m128i zero = _mm_setzero_si128();
+		__m128i full = _mm_set1_epi16(256);
+		__m128i round = _mm_set1_epi16(128);
+		for (int g = 0; g < taps->groups; g++) {
+			__m128i s = _mm_loadu_si128((const __m128i *)(src + taps->group_index[g]));
+			__m128i shuffle = _mm_loadu_si128((const __m128i *)(taps->group_shuffle + g * 16));
+			__m128i weight = _mm_loadu_si128((const __m128i *)(taps->weight + g * 8));
+			__m128i pairs = _mm_shuffle_epi8(s, shuffle);
+			__m128i blend = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+				_mm_mullo_epi16(_mm_unpacklo_epi8(pairs, zero), _mm_sub_epi16(full, weight)),
+				_mm_mullo_epi16(_mm_unpackhi_epi8(pairs, zero), weight)),
+				round), 8);
+			_mm_storel_epi64((__m128i *)(dest + g * 8), _mm_packus_epi16(blend, blend));
+		}
+	}
+	plm_frame_scale_samples(taps, src, dest, taps->groups * taps->group_size);
+}
+
+PLM_SIMD_TARGET("sse2")
+void plm_frame_blend_lines_sse2(const uint8_t *a, const uint8_t *b, uint8_t *dest, int length, int weight) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i wa = _mm_set1_epi16(256 - weight);
+	__m128i wb = _mm_set1_epi16(weight);
+	__m128i round = _mm_set1_epi16(128);
+	int i = 0;
+	for (; i + 16 <= length; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb)), round), 8);
+		__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb)), round), 8);
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(lo, hi));
+	}
+	plm_frame_blend_lines_scalar(a + i, b + i, dest + i, length - i, weight);
+}
+
+PLM_SIMD_TARGET("avx2")
+void plm_frame_blend_lines_avx2(const uint8_t *a, const uint8_t *b, uint8_t *dest, int length, int weight) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i wa = _mm256_set1_epi16(256 - weight);
+	__m256i wb = _mm256_set1_epi16(weight);
+	__m256i round = _mm256_set1_epi16(128);
+	int i = 0;
+	for (; i + 32 <= length; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		__m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+			_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), wa),
+			_mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), wb)), round), 8);
+		__m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+			_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), wa),
+			_mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), wb)), round), 8);
+		_mm256_storeu_si256((__m256i *)(dest + i), _mm256_packus_epi16(lo, hi));
+	}
+	plm_frame_blend_lines_sse2(a + i, b + i, dest + i, length - i, weight);
+}
+
+#endif // PLM_SIMD_X86
+
+plm_frame_scaler_t *plm_frame_scaler_create(int filter) {
+	plm_frame_scaler_t *self = (plm_frame_scaler_t *)malloc(sizeof(plm_frame_scaler_t));
+	memset(self, 0, sizeof(plm_frame_scaler_t));
+	self->filter = filter;
+
+	int features = plm_cpu_features();
+	PLM_UNUSED(features);
+
+	self->scale_line = plm_frame_scale_line_scalar;
+	self->blend_lines = plm_frame_blend_lines_scalar;
+
+	#if defined(PLM_SIMD_X86)
+		if (features & PLM_CPU_SSE2) {
+			self->blend_lines = plm_frame_blend_lines_sse2;
+		}
+		if (features & PLM_CPU_SSSE3) {
+			self->scale_line = plm_frame_scale_line_ssse3;
+		}
+		if (features & PLM_CPU_AVX2) {
+			self->blend_lines = plm_frame_blend_lines_avx2;
+		}
+	#endif
+
+	for (int i = 0; i < PLM_FRAME_FORMAT_COUNT; i++) {
+		self->convert[i] = plm_frame_get_convert_function((enum plm_frame_format)i);
+	}
+
+	return self;
+}
+
+void plm_frame_scaler_destroy(plm_frame_scaler_t *self) {
+	free(self->taps_data);
+	free(self->buffer_data);
+	free(self);
+}
+
+void plm_frame_scaler_resize(plm_frame_scaler_t *self, int src_width, int src_height, int width, int height) {
+	int src_c_width = (src_width + 1) >> 1;
+	int src_c_height = (src_height + 1) >> 1;
+	int c_width = (width + 1) >> 1;
+	int c_height = (height + 1) >> 1;
+
+	free(self->taps_data);
+	free(self->buffer_data);
+
+	size_t taps_sizes[4] = {
+		plm_frame_scale_taps_size(width), plm_frame_scale_taps_size(c_width),
+		plm_frame_scale_taps_size(height), plm_frame_scale_taps_size(c_height)
+	};
+	uint8_t *taps_data = (uint8_t *)malloc(taps_sizes[0] + taps_sizes[1] + taps_sizes[2] + taps_sizes[3]);
+	self->taps_data = taps_data;
+
+	plm_frame_scale_taps_init(&self->columns[0], taps_data, width, src_width, self->filter);
+	taps_data += taps_sizes[0];
+	plm_frame_scale_taps_init(&self->columns[1], taps_data, c_width, src_c_width, self->filter);
+	taps_data += taps_sizes[1];
+	plm_frame_scale_taps_init(&self->lines[0], taps_data, height, src_height, self->filter);
+	taps_data += taps_sizes[2];
+	plm_frame_scale_taps_init(&self->lines[1], taps_data, c_height, src_c_height, self->filter);
+
+	// A band of each plane and two scaled source lines per plane; the widths
+	// are padded so every line starts on a 32 byte boundary
+	int y_stride = (width + 31) & ~31;
+	int c_stride = (c_width + 31) & ~31;
+	size_t band_size = PLM_FRAME_SCALE_BAND * y_stride + PLM_FRAME_SCALE_BAND * c_stride;
+	size_t lines_size = 2 * y_stride + 4 * c_stride;
+	uint8_t *buffer_data = (uint8_t *)malloc(band_size + lines_size + 31);
+	self->buffer_data = buffer_data;
+	buffer_data = (uint8_t *)(((uintptr_t)buffer_data + 31) & ~(uintptr_t)31);
+
+	self->band_stride[0] = y_stride;
+	self->band_stride[1] = c_stride;
+	self->band[0] = buffer_data;
+	self->band[1] = self->band[0] + PLM_FRAME_SCALE_BAND * y_stride;
+	self->band[2] = self->band[1] + (PLM_FRAME_SCALE_BAND >> 1) * c_stride;
+	self->line_buffers[0][0] = self->band[2] + (PLM_FRAME_SCALE_BAND >> 1) * c_stride;
+	self->line_buffers[0][1] = self->line_buffers[0][0] + y_stride;
+	self->line_buffers[1][0] = self->line_buffers[0][1] + y_stride;
+	self->line_buffers[1][1] = self->line_buffers[1][0] + c_stride;
+	self->line_buffers[2][0] = self->line_buffers[1][1] + c_stride;
+	self->line_buffers[2][1] = self->line_buffers[2][0] + c_stride;
+
+	self->src_width = src_width;
+	self->src_height = src_height;
+	self->width = width;
+	self->height = height;
+}
+
+const uint8_t *plm_frame_scaler_get_line(plm_frame_scaler_t *self, int plane, const plm_plane_t *src, int line) {
+	int *tags = self->line_tags[plane];
+	if (tags[0] == line) {
+		return self->line_buffers[plane][0];
+	}
+	if (tags[1] == line) {
+		return self->line_buffers[plane][1];
+	}
+
+	const plm_frame_scale_taps_t *columns = &self->columns[plane ? 1 : 0];
+	const uint8_t *s = src->data + line * src->width;
+	if (columns->identity) {
+		return s;
+	}
+
+	// Lines are requested in increasing order, so the lower one is done with
+	int slot = tags[0] < tags[1] ? 0 : 1;
+	tags[slot] = line;
+	self->scale_line(columns, s, self->line_buffers[plane][slot]);
+	return self->line_buffers[plane][slot];
+}
+
+void plm_frame_scaler_scale_line(
+	plm_frame_scaler_t *self, int plane, const plm_plane_t *src,
+	const plm_frame_scale_taps_t *lines, int line, uint8_t *dest
+) {
+	int size = self->columns[plane ? 1 : 0].size;
+	int index = lines->index[line];
+	int weight = lines->weight[line];
+	const uint8_t *a = plm_frame_scaler_get_line(self, plane, src, index);
+
+	if (weight) {
+		const uint8_t *b = plm_frame_scaler_get_line(self, plane, src, index + 1);
+		self->blend_lines(a, b, dest, size, weight);
+	}
+	else {
+		memcpy(dest, a, size);
+	}
+}
+
+int plm_frame_scaler_band_changed(plm_frame_scaler_t *self, int first, int count, const uint8_t *rows) {
+	if (!rows) {
+		return TRUE;
+	}
+
+	// The source lines of a band are a contiguous range; a chroma line i lies
+	// in macroblock row i / 8
+	const plm_frame_scale_taps_t *y = &self->lines[0];
+	const plm_frame_scale_taps_t *c = &self->lines[1];
+	int last = first + count - 1;
+	int c_first = first >> 1;
+	int c_last = last >> 1;
+	int y_from = y->index[first] >> 4;
+	int y_to = (y->index[last] + (y->weight[last] ? 1 : 0)) >> 4;
+	int c_from = c->index[c_first] >> 3;
+	int c_to = (c->index[c_last] + (c->weight[c_last] ? 1 : 0)) >> 3;
+	int from = y_from < c_from ? y_from : c_from;
+	int to = y_to > c_to ? y_to : c_to;
+
+	for (int i = from; i <= to; i++) {
+		if (rows[i]) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static inline void plm_frame_put_scaled_pixel(
+	uint8_t *d, int y, int cb, int cr, plm_frame_coeffs_t coeffs, int ri, int gi, int bi
+) {
+	cr -= 128;
+	cb -= 128;
+	int r = (cr * coeffs.r) >> 16;
+	int g = (cb * coeffs.g_cb + cr * coeffs.g_cr) >> 16;
+	int b = (cb * coeffs.b) >> 16;
+	y = ((y - 16) * coeffs.y) >> 16;
+	d[ri] = plm_frame_clamp(y + r, coeffs.max);
+	d[gi] = plm_frame_clamp(y - g, coeffs.max);
+	d[bi] = plm_frame_clamp(y + b, coeffs.max);
+}
+
+void plm_frame_convert_scaled(
+	plm_frame_scaler_t *self, plm_frame_t *frame, uint8_t *dest, int stride, int width, int height,
+	const uint8_t *rows, int intensity, plm_frame_convert_t convert,
+	int bytes_per_pixel, int ri, int gi, int bi
+) {
+	int src_width = frame->width;
+	int src_height = frame->height;
+	if (width <= 0 || height <= 0 || src_width <= 0 || src_height <= 0) {
+		return;
+	}
+
+	if (
+		self->src_width != src_width || self->src_height != src_height ||
+		self->width != width || self->height != height
+	) {
+		plm_frame_scaler_resize(self, src_width, src_height, width, height);
+	}
+
+	for (int plane = 0; plane < 3; plane++) {
+		self->line_tags[plane][0] = self->line_tags[plane][1] = -1;
+	}
+
+	plm_frame_coeffs_t coeffs = plm_frame_get_coeffs(intensity);
+	plm_plane_t *planes[3] = {&frame->y, &frame->cb, &frame->cr};
+	int y_stride = self->band_stride[0];
+	int c_stride = self->band_stride[1];
+
+	plm_frame_t band;
+	memset(&band, 0, sizeof(plm_frame_t));
+	band.width = width;
+	band.y.width = y_stride;
+	band.y.data = self->band[0];
+	band.cb.width = band.cr.width = c_stride;
+	band.cb.data = self->band[1];
+	band.cr.data = self->band[2];
+
+	for (int first = 0; first < height; first += PLM_FRAME_SCALE_BAND) {
+		int count = height - first < PLM_FRAME_SCALE_BAND ? height - first : PLM_FRAME_SCALE_BAND;
+		if (!plm_frame_scaler_band_changed(self, first, count, rows)) {
+			continue;
+		}
+
+		for (int i = 0; i < count; i++) {
+			plm_frame_scaler_scale_line(
+				self, 0, planes[0], &self->lines[0], first + i, self->band[0] + i * y_stride
+			);
+		}
+		for (int i = 0; i < (count + 1) >> 1; i++) {
+			for (int plane = 1; plane < 3; plane++) {
+				plm_frame_scaler_scale_line(
+					self, plane, planes[plane], &self->lines[1], (first >> 1) + i,
+					self->band[plane] + i * c_stride
+				);
+			}
+		}
+
+		uint8_t *d = dest + first * stride;
+		band.height = count;
+		convert(&band, d, stride, coeffs);
+
+		// The conversion works on 2x2 pixels; an odd last column or line is
+		// converted here
+		for (int i = 0; i < count; i++) {
+			int from = (i | 1) < count ? width & ~1 : 0;
+			for (int x = from; x < width; x++) {
+				int c_index = (i >> 1) * c_stride + (x >> 1);
+				plm_frame_put_scaled_pixel(
+					d + i * stride + x * bytes_per_pixel, self->band[0][i * y_stride + x],
+					self->band[1][c_index], self->band[2][c_index], coeffs, ri, gi, bi
+				);
+			}
+		}
+	}
+}
+
+#define PLM_DEFINE_FRAME_SCALE_FUNCTION(NAME, FORMAT, BYTES_PER_PIXEL, RI, GI, BI) \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride, int width, int height, plm_frame_scaler_t *scaler, const uint8_t *rows, int intensity) { \
+		plm_frame_convert_scaled( \
+			scaler, frame, dest, stride, width, height, rows, intensity, scaler->convert[FORMAT], \
+			BYTES_PER_PIXEL, RI, GI, BI \
+		); \
+	}
+
+PLM_DEFINE_FRAME_SCALE_FUNCTION(plm_frame_to_rgb_scaled,  PLM_FRAME_FORMAT_RGB,  3, 0, 1, 2)
+PLM_DEFINE_FRAME_SCALE_FUNCTION(plm_frame_to_bgr_scaled,  PLM_FRAME_FORMAT_BGR,  3, 2, 1, 0)
+PLM_DEFINE_FRAME_SCALE_FUNCTION(plm_frame_to_rgba_scaled, PLM_FRAME_FORMAT_RGBA, 4, 0, 1, 2)
+PLM_DEFINE_FRAME_SCALE_FUNCTION(plm_frame_to_bgra_scaled, PLM_FRAME_FORMAT_BGRA, 4, 2, 1, 0)
+PLM_DEFINE_FRAME_SCALE_FUNCTION(plm_frame_to_argb_scaled, PLM_FRAME_FORMAT_ARGB, 4, 1, 2, 3)
+PLM_DEFINE_FRAME_SCALE_FUNCTION(plm_frame_to_abgr_scaled, PLM_FRAME_FORMAT_ABGR, 4, 3, 2, 1)
 
 
 #undef PLM_PUT_PIXEL
+#undef PLM_CONVERT_CHROMA_SAMPLE
 #undef PLM_DEFINE_FRAME_CONVERT_FUNCTION
+#undef PLM_DEFINE_FRAME_CONVERT_DISPATCH
+#undef PLM_DEFINE_FRAME_SCALE_FUNCTION
+#undef PLM_DEFINE_FRAME_ROWS_FUNCTION
+#undef PLM_SIMD_CHANNEL
+#undef PLM_SIMD_ALPHA_INDEX
 
 
 
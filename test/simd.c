@@ -0,0 +1,374 @@
+// Checks that the SIMD kernels of pl_mpeg are bit-exact with the scalar code
+// they replace. Random coefficient blocks go through every IDCT kernel and
+// variant and are compared against plm_video_idct(), random blocks go through
+// every motion compensation case, random frames through every color 
+// conversion at several intensities and random lines through the horizontal
+// and vertical passes of the scaled conversion. Only the kernels compiled in and
+// supported by the CPU are checked; with PLM_NO_SIMD that is just the reduced
+// scalar variants.
+
+#define PL_MPEG_IMPLEMENTATION
+#include "pl_mpeg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ITERATIONS 20000
+
+typedef struct
+{
+	const char *name;
+	plm_video_idct_store_t put;
+	plm_video_idct_store_t add;
+} test_idct_kernel_t;
+
+typedef void(*test_mc_t)(uint8_t *s, uint8_t *d, int dw, int block_size, int mc_case);
+
+typedef struct
+{
+	const char *name;
+	test_mc_t compensate;
+} test_mc_kernel_t;
+
+typedef struct
+{
+	const char *name;
+	plm_frame_convert_t convert;
+	plm_frame_convert_t reference;
+	int bytes_per_pixel;
+} test_convert_kernel_t;
+
+typedef struct
+{
+	const char *name;
+	plm_frame_scale_line_t scale_line;
+	plm_frame_blend_lines_t blend_lines;
+} test_scale_kernel_t;
+
+static const char *test_variant_names[] = {"first row", "first column", "top left 4x4", "full"};
+
+static void test_random_block(int *block, int variant)
+{
+	memset(block, 0, 64 * sizeof(int));
+
+	// Dense or sparse, within the part of the block the variant covers
+	int density = rand() % 4 == 0 ? 1 : 1 + rand() % 8;
+	for(int i = 0; i < 64; i++)
+	{
+		int x = i % 8, y = i / 8;
+		if(
+			(variant == PLM_VIDEO_IDCT_FIRST_ROW && y != 0) ||
+			(variant == PLM_VIDEO_IDCT_FIRST_COLUMN && x != 0) ||
+			(variant == PLM_VIDEO_IDCT_TOP_LEFT_4X4 && (x > 3 || y > 3)) ||
+			rand() % density != 0
+		)
+			continue;
+
+		// Dequantized levels are clamped to [-2048, 2047] before premultiplying
+		int level = rand() % 8 == 0 ? (rand() % 4096) - 2048 : (rand() % 64) - 32;
+		block[i] = level * PLM_VIDEO_PREMULTIPLIER_MATRIX[i];
+	}
+}
+
+static void test_reference_store(const int *block, uint8_t *dest, int add)
+{
+	int tmp[64];
+
+	memcpy(tmp, block, sizeof(tmp));
+	plm_video_idct(tmp);
+	for(int i = 0; i < 64; i++)
+		dest[(i / 8) * 16 + i % 8] = plm_clamp(add ? dest[(i / 8) * 16 + i % 8] + tmp[i] : tmp[i]);
+}
+
+static int test_idct(const test_idct_kernel_t *kernel)
+{
+	int block[64], coefficients[64], failures = 0;
+	uint8_t expected[8 * 16], got[8 * 16];
+
+	for(int variant = PLM_VIDEO_IDCT_FIRST_ROW; variant <= PLM_VIDEO_IDCT_FULL; variant++)
+	{
+		for(int i = 0; i < TEST_ITERATIONS; i++)
+		{
+			int add = i & 1;
+
+			test_random_block(coefficients, variant);
+			for(size_t j = 0; j < sizeof(expected); j++)
+				expected[j] = got[j] = rand();
+
+			test_reference_store(coefficients, expected, add);
+
+			memcpy(block, coefficients, sizeof(block));
+			(add ? kernel->add : kernel->put)(block, got, 16, variant);
+
+			int cleared = 1;
+			for(int j = 0; j < 64; j++)
+				cleared &= block[j] == 0;
+
+			if(memcmp(expected, got, sizeof(expected)) != 0 || !cleared)
+			{
+				printf(
+					"FAIL idct %s %s %s: %s\n", kernel->name, test_variant_names[variant],
+					add ? "add" : "put", cleared ? "output differs" : "block not cleared"
+				);
+				failures++;
+				break;
+			}
+		}
+	}
+
+	if(!failures)
+		printf("ok   idct %s\n", kernel->name);
+
+	return failures;
+}
+
+static int test_mc(const test_mc_kernel_t *kernel)
+{
+	uint8_t source[17 * 24], expected[16 * 24], got[16 * 24];
+	int failures = 0;
+
+	for(int block_size = 8; block_size <= 16; block_size += 8)
+	{
+		for(int mc_case = 0; mc_case < 8; mc_case++)
+		{
+			for(int i = 0; i < TEST_ITERATIONS / 10; i++)
+			{
+				for(size_t j = 0; j < sizeof(source); j++)
+					source[j] = rand();
+				for(size_t j = 0; j < sizeof(expected); j++)
+					expected[j] = got[j] = rand();
+
+				plm_video_motion_compensate_scalar(source, expected, 24, block_size, mc_case);
+				kernel->compensate(source, got, 24, block_size, mc_case);
+
+				if(memcmp(expected, got, sizeof(expected)) != 0)
+				{
+					printf("FAIL mc %s %dx%d case %d\n", kernel->name, block_size, block_size, mc_case);
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+
+	if(!failures)
+		printf("ok   mc %s\n", kernel->name);
+
+	return failures;
+}
+
+static int test_convert(const test_convert_kernel_t *kernel)
+{
+	static const int intensities[] = {256, 255, 200, 128, 51, 1, 0};
+	uint8_t *planes, *expected, *got;
+	int failures = 0;
+
+	// Sizes that are no multiple of the SIMD block widths leave columns for
+	// the scalar tail as well
+	int width = 2 * (2 * 16 + 7), height = 2 * 9;
+	int stride = width * kernel->bytes_per_pixel + 5;
+
+	plm_frame_t frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.width = width;
+	frame.height = height;
+	frame.y.width = (width + 15) & ~15;
+	frame.y.height = (height + 15) & ~15;
+	frame.cr.width = frame.cb.width = frame.y.width >> 1;
+	frame.cr.height = frame.cb.height = frame.y.height >> 1;
+
+	size_t y_size = frame.y.width * frame.y.height, c_size = frame.cb.width * frame.cb.height;
+	planes = malloc(y_size + 2 * c_size);
+	expected = malloc(stride * height);
+	got = malloc(stride * height);
+	frame.y.data = planes;
+	frame.cb.data = planes + y_size;
+	frame.cr.data = planes + y_size + c_size;
+
+	for(size_t i = 0; i < sizeof(intensities) / sizeof(intensities[0]) && !failures; i++)
+	{
+		for(int n = 0; n < TEST_ITERATIONS / 100; n++)
+		{
+			for(size_t j = 0; j < y_size + 2 * c_size; j++)
+				planes[j] = rand();
+			for(int j = 0; j < stride * height; j++)
+				expected[j] = got[j] = rand();
+
+			kernel->reference(&frame, expected, stride, plm_frame_get_coeffs(intensities[i]));
+			kernel->convert(&frame, got, stride, plm_frame_get_coeffs(intensities[i]));
+
+			if(memcmp(expected, got, stride * height) != 0)
+			{
+				printf("FAIL convert %s intensity %d\n", kernel->name, intensities[i]);
+				failures++;
+				break;
+			}
+		}
+	}
+
+	if(!failures)
+		printf("ok   convert %s\n", kernel->name);
+
+	free(planes);
+	free(expected);
+	free(got);
+	return failures;
+}
+
+static int test_scale(const test_scale_kernel_t *kernel)
+{
+	// Upscaling, downscaling within and beyond the gather window and sizes that
+	// leave samples for the scalar tail
+	static const int sizes[][2] = {
+		{64, 128}, {37, 300}, {320, 256}, {128, 96}, {300, 41}, {1280, 2560}, {1, 7}, {16, 16}, {17, 33}
+	};
+	uint8_t source[1280], expected[2560], got[2560], a[2560], b[2560];
+	uint8_t *taps_data = malloc(plm_frame_scale_taps_size(2560));
+	int failures = 0;
+
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !failures; i++)
+	{
+		for(int filter = PLM_FRAME_FILTER_NEAREST; filter <= PLM_FRAME_FILTER_BILINEAR; filter++)
+		{
+			plm_frame_scale_taps_t taps;
+			plm_frame_scale_taps_init(&taps, taps_data, sizes[i][1], sizes[i][0], filter);
+
+			for(int n = 0; n < TEST_ITERATIONS / 1000; n++)
+			{
+				for(int j = 0; j < sizes[i][0]; j++)
+					source[j] = rand();
+				for(int j = 0; j < sizes[i][1]; j++)
+					expected[j] = got[j] = rand();
+
+				plm_frame_scale_line_scalar(&taps, source, expected);
+				kernel->scale_line(&taps, source, got);
+
+				if(memcmp(expected, got, sizes[i][1]) != 0)
+				{
+					printf(
+						"FAIL scale %s line %d to %d %s\n", kernel->name, sizes[i][0], sizes[i][1],
+						filter == PLM_FRAME_FILTER_NEAREST ? "nearest" : "bilinear"
+					);
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+
+	for(int n = 0; n < TEST_ITERATIONS && !failures; n++)
+	{
+		int length = 1 + rand() % 100, weight = 1 + rand() % 255;
+		for(int j = 0; j < length; j++)
+		{
+			a[j] = rand();
+			b[j] = rand();
+			expected[j] = got[j] = rand();
+		}
+
+		plm_frame_blend_lines_scalar(a, b, expected, length, weight);
+		kernel->blend_lines(a, b, got, length, weight);
+
+		if(memcmp(expected, got, length) != 0)
+		{
+			printf("FAIL scale %s blend %d weight %d\n", kernel->name, length, weight);
+			failures++;
+		}
+	}
+
+	if(!failures)
+		printf("ok   scale %s\n", kernel->name);
+
+	free(taps_data);
+	return failures;
+}
+
+int main(void)
+{
+	int features = plm_cpu_features(), failures = 0;
+	PLM_UNUSED(features);
+
+	test_idct_kernel_t idct_kernels[] = {
+		{"scalar", plm_video_idct_put_scalar, plm_video_idct_add_scalar},
+		#if defined(PLM_SIMD_X86)
+			{"sse2", features & PLM_CPU_SSE2 ? plm_video_idct_put_sse2 : NULL, plm_video_idct_add_sse2},
+			{"avx2", features & PLM_CPU_AVX2 ? plm_video_idct_put_avx2 : NULL, plm_video_idct_add_avx2},
+		#elif defined(PLM_SIMD_NEON)
+			{"neon", features & PLM_CPU_NEON ? plm_video_idct_put_neon : NULL, plm_video_idct_add_neon},
+		#endif
+	};
+	test_mc_kernel_t mc_kernels[] = {
+		#if defined(PLM_SIMD_X86)
+			{"sse2", features & PLM_CPU_SSE2 ? plm_video_motion_compensate_sse2 : NULL},
+		#elif defined(PLM_SIMD_NEON)
+			{"neon", features & PLM_CPU_NEON ? plm_video_motion_compensate_neon : NULL},
+		#endif
+		{NULL, NULL}
+	};
+	test_convert_kernel_t convert_kernels[] = {
+		#if defined(PLM_SIMD_X86)
+			{"rgb ssse3", features & PLM_CPU_SSSE3 ? plm_frame_to_rgb_ssse3 : NULL, plm_frame_to_rgb_scalar, 3},
+			{"bgr ssse3", features & PLM_CPU_SSSE3 ? plm_frame_to_bgr_ssse3 : NULL, plm_frame_to_bgr_scalar, 3},
+			{"rgba sse2", features & PLM_CPU_SSE2 ? plm_frame_to_rgba_sse2 : NULL, plm_frame_to_rgba_scalar, 4},
+			{"bgra sse2", features & PLM_CPU_SSE2 ? plm_frame_to_bgra_sse2 : NULL, plm_frame_to_bgra_scalar, 4},
+			{"argb sse2", features & PLM_CPU_SSE2 ? plm_frame_to_argb_sse2 : NULL, plm_frame_to_argb_scalar, 4},
+			{"abgr sse2", features & PLM_CPU_SSE2 ? plm_frame_to_abgr_sse2 : NULL, plm_frame_to_abgr_scalar, 4},
+			{"rgba avx2", features & PLM_CPU_AVX2 ? plm_frame_to_rgba_avx2 : NULL, plm_frame_to_rgba_scalar, 4},
+			{"bgra avx2", features & PLM_CPU_AVX2 ? plm_frame_to_bgra_avx2 : NULL, plm_frame_to_bgra_scalar, 4},
+			{"argb avx2", features & PLM_CPU_AVX2 ? plm_frame_to_argb_avx2 : NULL, plm_frame_to_argb_scalar, 4},
+			{"abgr avx2", features & PLM_CPU_AVX2 ? plm_frame_to_abgr_avx2 : NULL, plm_frame_to_abgr_scalar, 4},
+		#elif defined(PLM_SIMD_NEON)
+			{"rgb neon", features & PLM_CPU_NEON ? plm_frame_to_rgb_neon : NULL, plm_frame_to_rgb_scalar, 3},
+			{"bgr neon", features & PLM_CPU_NEON ? plm_frame_to_bgr_neon : NULL, plm_frame_to_bgr_scalar, 3},
+			{"rgba neon", features & PLM_CPU_NEON ? plm_frame_to_rgba_neon : NULL, plm_frame_to_rgba_scalar, 4},
+			{"bgra neon", features & PLM_CPU_NEON ? plm_frame_to_bgra_neon : NULL, plm_frame_to_bgra_scalar, 4},
+			{"argb neon", features & PLM_CPU_NEON ? plm_frame_to_argb_neon : NULL, plm_frame_to_argb_scalar, 4},
+			{"abgr neon", features & PLM_CPU_NEON ? plm_frame_to_abgr_neon : NULL, plm_frame_to_abgr_scalar, 4},
+		#endif
+		{NULL, NULL, NULL, 0}
+	};
+	test_scale_kernel_t scale_kernels[] = {
+		#if defined(PLM_SIMD_X86)
+			{"ssse3 sse2", features & PLM_CPU_SSSE3 ? plm_frame_scale_line_ssse3 : NULL, plm_frame_blend_lines_sse2},
+			{"ssse3 avx2", features & PLM_CPU_AVX2 ? plm_frame_scale_line_ssse3 : NULL, plm_frame_blend_lines_avx2},
+		#endif
+		{NULL, NULL, NULL}
+	};
+
+	srand(1);
+
+	for(size_t i = 0; i < sizeof(idct_kernels) / sizeof(idct_kernels[0]); i++)
+	{
+		if(idct_kernels[i].put != NULL)
+			failures += test_idct(&idct_kernels[i]);
+		else
+			printf("skip idct %s: not supported by this CPU\n", idct_kernels[i].name);
+	}
+
+	for(size_t i = 0; mc_kernels[i].name != NULL; i++)
+	{
+		if(mc_kernels[i].compensate != NULL)
+			failures += test_mc(&mc_kernels[i]);
+		else
+			printf("skip mc %s: not supported by this CPU\n", mc_kernels[i].name);
+	}
+
+	for(size_t i = 0; convert_kernels[i].name != NULL; i++)
+	{
+		if(convert_kernels[i].convert != NULL)
+			failures += test_convert(&convert_kernels[i]);
+		else
+			printf("skip convert %s: not supported by this CPU\n", convert_kernels[i].name);
+	}
+
+	for(size_t i = 0; scale_kernels[i].name != NULL; i++)
+	{
+		if(scale_kernels[i].scale_line != NULL)
+			failures += test_scale(&scale_kernels[i]);
+		else
+			printf("skip scale %s: not supported by this CPU\n", scale_kernels[i].name);
+	}
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}